@@ -0,0 +1,60 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include <typed-geometry/tg-lean.hh>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define SI_COLOR_SSE2 1
+#endif
+
+namespace si::detail
+{
+/// packs a color into RGBA8 (r in the lowest byte)
+inline uint32_t to_rgba8(tg::color4 const& c)
+{
+    auto r = uint32_t(tg::clamp(int(256 * c.r), 0, 255));
+    auto g = uint32_t(tg::clamp(int(256 * c.g), 0, 255));
+    auto b = uint32_t(tg::clamp(int(256 * c.b), 0, 255));
+    auto a = uint32_t(tg::clamp(int(256 * c.a), 0, 255));
+    return (a << 24) | (b << 16) | (g << 8) | r;
+}
+
+/// packs count colors into RGBA8
+/// colors and out are strided (in bytes), e.g. to convert the colors of a vertex array in place
+/// NOTE: converts 4 colors at a time if SSE2 is available (same results as to_rgba8)
+inline void to_rgba8(tg::color4 const* colors, size_t colors_stride, size_t count, uint32_t* out, size_t out_stride)
+{
+    auto const color_at = [&](size_t i) -> tg::color4 const& {
+        return *reinterpret_cast<tg::color4 const*>(reinterpret_cast<std::byte const*>(colors) + i * colors_stride);
+    };
+    auto const out_at = [&](size_t i) -> uint32_t& { return *reinterpret_cast<uint32_t*>(reinterpret_cast<std::byte*>(out) + i * out_stride); };
+
+    size_t i = 0;
+
+#ifdef SI_COLOR_SSE2
+    auto const scale = _mm_set1_ps(256.f);
+    auto const load = [&](size_t ci) { return _mm_cvttps_epi32(_mm_mul_ps(_mm_loadu_ps(&color_at(ci).r), scale)); };
+
+    for (; i + 4 <= count; i += 4)
+    {
+        // NOTE: saturating packs clamp to 0..255
+        auto const lo = _mm_packs_epi32(load(i + 0), load(i + 1));
+        auto const hi = _mm_packs_epi32(load(i + 2), load(i + 3));
+        auto const packed = _mm_packus_epi16(lo, hi);
+
+        alignas(16) uint32_t res[4];
+        _mm_store_si128(reinterpret_cast<__m128i*>(res), packed);
+        out_at(i + 0) = res[0];
+        out_at(i + 1) = res[1];
+        out_at(i + 2) = res[2];
+        out_at(i + 3) = res[3];
+    }
+#endif
+
+    for (; i < count; ++i)
+        out_at(i) = to_rgba8(color_at(i));
+}
+}
@@ -0,0 +1,124 @@
+#pragma once
+
+#include <cstdint>
+
+#include <clean-core/map.hh>
+#include <clean-core/vector.hh>
+
+namespace si::detail
+{
+/**
+ * A hash-keyed cache whose entries are evicted if they were not used for a number of frames
+ *
+ * Usage:
+ *
+ *   frame_cache<metrics> cache;
+ *
+ *   // once per frame
+ *   cache.next_frame();
+ *
+ *   auto m = cache.get(key);
+ *   if (!m)
+ *       m = &cache.insert(key, compute_metrics());
+ *
+ * Notes:
+ *
+ *   - pointers to values are only valid until the next insert or next_frame
+ *   - peek is safe to call concurrently as long as nothing modifies the cache
+ *   - eviction is amortized: entries are only compacted every max_age frames
+ */
+template <class ValueT>
+struct frame_cache
+{
+    explicit frame_cache(int max_age = 128) : _max_age(max_age) {}
+
+    /// returns nullptr if not cached, marks the entry as used otherwise
+    ValueT* get(uint64_t key)
+    {
+        int idx;
+        if (!_index.get_to(key, idx))
+            return nullptr;
+
+        auto& e = _entries[idx];
+        e.last_used_frame = _frame;
+        return &e.value;
+    }
+
+    /// same as get but does not mark the entry as used
+    ValueT const* peek(uint64_t key) const
+    {
+        int idx;
+        if (!_index.get_to(key, idx))
+            return nullptr;
+
+        return &_entries[idx].value;
+    }
+
+    /// marks the entry as used (if cached)
+    void touch(uint64_t key) { get(key); }
+
+    /// adds or replaces the entry for the given key
+    ValueT& insert(uint64_t key, ValueT value)
+    {
+        int idx;
+        if (!_index.get_to(key, idx))
+        {
+            idx = int(_entries.size());
+            _index[key] = idx;
+            _entries.emplace_back();
+            _entries.back().key = key;
+        }
+
+        auto& e = _entries[idx];
+        e.value = cc::move(value);
+        e.last_used_frame = _frame;
+        return e.value;
+    }
+
+    /// advances the frame counter and evicts entries that were unused for max_age frames
+    void next_frame()
+    {
+        ++_frame;
+        if (_frame % _max_age != 0)
+            return;
+
+        auto cnt = 0;
+        for (auto i = 0; i < int(_entries.size()); ++i)
+            if (_frame - _entries[i].last_used_frame <= _max_age)
+            {
+                if (cnt != i)
+                    _entries[cnt] = cc::move(_entries[i]);
+                ++cnt;
+            }
+
+        if (cnt == int(_entries.size()))
+            return;
+
+        _entries.resize(cnt);
+        _index.clear();
+        for (auto i = 0; i < cnt; ++i)
+            _index[_entries[i].key] = i;
+    }
+
+    void clear()
+    {
+        _entries.clear();
+        _index.clear();
+    }
+
+    int size() const { return int(_entries.size()); }
+
+private:
+    struct entry
+    {
+        uint64_t key = 0;
+        int last_used_frame = 0;
+        ValueT value;
+    };
+
+    cc::vector<entry> _entries;
+    cc::map<uint64_t, int> _index;
+    int _frame = 0;
+    int _max_age;
+};
+}
@@ -0,0 +1,161 @@
+#pragma once
+
+#include <cstddef>
+
+#include <clean-core/string_view.hh>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define SI_UTF8_SSE2 1
+#endif
+
+namespace si::detail
+{
+/// true for the 2nd..4th byte of multi-byte chars
+inline bool is_utf8_continuation(char c) { return ((unsigned char)c & 0xC0) == 0x80; }
+
+/// decodes the codepoint starting at txt[pos] and advances pos past it
+/// NOTE: invalid or truncated sequences decode to U+FFFD and advance by one byte
+inline char32_t decode_utf8(cc::string_view txt, size_t& pos)
+{
+    auto const b0 = (unsigned char)txt[pos];
+    if (b0 < 0x80)
+    {
+        ++pos;
+        return b0;
+    }
+
+    int len;
+    char32_t cp;
+    if ((b0 & 0xE0) == 0xC0)
+    {
+        len = 2;
+        cp = b0 & 0x1F;
+    }
+    else if ((b0 & 0xF0) == 0xE0)
+    {
+        len = 3;
+        cp = b0 & 0x0F;
+    }
+    else if ((b0 & 0xF8) == 0xF0)
+    {
+        len = 4;
+        cp = b0 & 0x07;
+    }
+    else
+    {
+        ++pos;
+        return 0xFFFD;
+    }
+
+    if (pos + len > txt.size())
+    {
+        ++pos;
+        return 0xFFFD;
+    }
+
+    for (auto i = 1; i < len; ++i)
+    {
+        auto const b = (unsigned char)txt[pos + i];
+        if ((b & 0xC0) != 0x80)
+        {
+            ++pos;
+            return 0xFFFD;
+        }
+        cp = (cp << 6) | (b & 0x3F);
+    }
+
+    pos += len;
+    return cp;
+}
+
+/// number of consecutive ASCII bytes starting at txt[pos]
+/// NOTE: checks 16 bytes at a time if SSE2 is available
+inline size_t ascii_run_length(cc::string_view txt, size_t pos)
+{
+    auto const start = pos;
+    auto const size = txt.size();
+
+#ifdef SI_UTF8_SSE2
+    while (pos + 16 <= size)
+    {
+        auto v = _mm_loadu_si128(reinterpret_cast<__m128i const*>(txt.data() + pos));
+        if (_mm_movemask_epi8(v) != 0) // some high bit set
+            break;
+        pos += 16;
+    }
+#endif
+
+    while (pos < size && (unsigned char)txt[pos] < 0x80)
+        ++pos;
+
+    return pos - start;
+}
+
+/// a decoded char and its byte range in the text
+struct utf8_char
+{
+    size_t start = 0;
+    size_t count = 1;
+    char32_t codepoint = 0;
+};
+
+/**
+ * Iterates the chars of a UTF-8 string
+ *
+ * Usage:
+ *
+ *   for (auto c : detail::utf8_chars(txt))
+ *       ... // c.codepoint, c.start, c.count
+ *
+ * ASCII runs are found in bulk (see ascii_run_length) and then iterated without decoding.
+ */
+struct utf8_iterator
+{
+    utf8_iterator(cc::string_view txt, size_t pos) : _txt(txt), _pos(pos), _ascii_end(pos) { read(); }
+
+    utf8_char const& operator*() const { return _curr; }
+    void operator++()
+    {
+        _pos += _curr.count;
+        read();
+    }
+    bool operator!=(utf8_iterator const& rhs) const { return _pos != rhs._pos; }
+
+private:
+    void read()
+    {
+        if (_pos >= _txt.size())
+            return;
+
+        if (_pos >= _ascii_end && (unsigned char)_txt[_pos] < 0x80)
+            _ascii_end = _pos + ascii_run_length(_txt, _pos);
+
+        if (_pos < _ascii_end)
+        {
+            _curr = {_pos, 1, char32_t((unsigned char)_txt[_pos])};
+            return;
+        }
+
+        auto p = _pos;
+        auto cp = decode_utf8(_txt, p);
+        _curr = {_pos, p - _pos, cp};
+    }
+
+    cc::string_view _txt;
+    size_t _pos = 0;
+    size_t _ascii_end = 0; ///< end of the current ASCII run
+    utf8_char _curr;
+};
+
+struct utf8_chars
+{
+    explicit utf8_chars(cc::string_view txt) : _txt(txt) {}
+
+    utf8_iterator begin() const { return {_txt, 0}; }
+    utf8_iterator end() const { return {_txt, _txt.size()}; }
+
+private:
+    cc::string_view _txt;
+};
+}
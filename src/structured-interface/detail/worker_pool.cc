@@ -0,0 +1,108 @@
+#include "worker_pool.hh"
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#include <clean-core/vector.hh>
+
+struct si::detail::worker_pool::state
+{
+    std::mutex mutex;
+    std::condition_variable cv_work;
+    std::condition_variable cv_done;
+
+    cc::vector<std::thread> threads;
+
+    // current job
+    cc::function_ref<void(int)> const* job = nullptr;
+    int job_count = 0;
+    std::atomic<int> next_idx = 0;
+    int active_workers = 0;
+    uint64_t generation = 0;
+    bool shutdown = false;
+
+    void work(cc::function_ref<void(int)> const& f, int count)
+    {
+        for (auto i = next_idx++; i < count; i = next_idx++)
+            f(i);
+
+        std::lock_guard lock(mutex);
+        if (--active_workers == 0)
+            cv_done.notify_all();
+    }
+
+    void run()
+    {
+        uint64_t seen_generation = 0;
+        while (true)
+        {
+            std::unique_lock lock(mutex);
+            cv_work.wait(lock, [&] { return shutdown || generation != seen_generation; });
+            if (shutdown)
+                return;
+
+            seen_generation = generation;
+            auto const& f = *job;
+            auto const count = job_count;
+            lock.unlock();
+
+            work(f, count);
+        }
+    }
+};
+
+si::detail::worker_pool::worker_pool(int thread_count) : _state(cc::make_unique<state>())
+{
+    if (thread_count < 0)
+        thread_count = int(std::thread::hardware_concurrency()) - 1;
+
+    for (auto i = 0; i < thread_count; ++i)
+        _state->threads.emplace_back([s = _state.get()] { s->run(); });
+}
+
+si::detail::worker_pool::~worker_pool()
+{
+    {
+        std::lock_guard lock(_state->mutex);
+        _state->shutdown = true;
+    }
+    _state->cv_work.notify_all();
+
+    for (auto& t : _state->threads)
+        t.join();
+}
+
+void si::detail::worker_pool::parallel_for(int count, cc::function_ref<void(int)> f)
+{
+    // nothing to distribute
+    if (count <= 1 || _state->threads.empty())
+    {
+        for (auto i = 0; i < count; ++i)
+            f(i);
+        return;
+    }
+
+    auto& s = *_state;
+    {
+        std::lock_guard lock(s.mutex);
+        s.job = &f;
+        s.job_count = count;
+        s.next_idx = 0;
+        s.active_workers = int(s.threads.size()) + 1;
+        ++s.generation;
+    }
+    s.cv_work.notify_all();
+
+    // calling thread helps
+    s.work(f, count);
+
+    // wait until every worker has left the job
+    // NOTE: required so that f is not referenced after returning
+    std::unique_lock lock(s.mutex);
+    s.cv_done.wait(lock, [&] { return s.active_workers == 0; });
+    s.job = nullptr;
+}
+
+int si::detail::worker_pool::thread_count() const { return int(_state->threads.size()); }
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <clean-core/function_ref.hh>
+#include <clean-core/unique_ptr.hh>
+
+namespace si::detail
+{
+/**
+ * A minimal fixed-size pool of worker threads
+ *
+ * Usage:
+ *
+ *   worker_pool pool;
+ *   pool.parallel_for(int(jobs.size()), [&](int i) { process(jobs[i]); });
+ *
+ * Notes:
+ *
+ *   - the calling thread participates in parallel_for
+ *   - indices are handed out dynamically, so jobs of uneven size balance out
+ */
+class worker_pool
+{
+public:
+    /// thread_count is the number of additional worker threads
+    /// (negative means hardware concurrency - 1)
+    explicit worker_pool(int thread_count = -1);
+    ~worker_pool();
+
+    worker_pool(worker_pool const&) = delete;
+    worker_pool(worker_pool&&) = delete;
+    worker_pool& operator=(worker_pool const&) = delete;
+    worker_pool& operator=(worker_pool&&) = delete;
+
+    /// calls f(i) for all i in [0, count) and blocks until all calls are done
+    /// NOTE: f must be safe to call concurrently for different i
+    void parallel_for(int count, cc::function_ref<void(int)> f);
+
+    int thread_count() const;
+
+private:
+    struct state;
+    cc::unique_ptr<state> _state;
+};
+}
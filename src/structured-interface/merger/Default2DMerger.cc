@@ -5,102 +5,210 @@
 #include <rich-log/log.hh>
 
 #include <algorithm> // sort
+#include <utility>   // swap
 
 #include <typed-geometry/tg.hh>
 
 #include <clean-core/strided_span.hh>
 
+#include <structured-interface/detail/color.hh>
+#include <structured-interface/detail/hash.hh>
+#include <structured-interface/detail/utf8.hh>
 #include <structured-interface/element_tree.hh>
 #include <structured-interface/input_state.hh>
 
 namespace
 {
-uint32_t to_rgba8(tg::color4 const& c)
+float line_align_offset(si::style::font_align align, float wrap_width, float line_width)
 {
-    auto r = uint32_t(tg::clamp(int(256 * c.r), 0, 255));
-    auto g = uint32_t(tg::clamp(int(256 * c.g), 0, 255));
-    auto b = uint32_t(tg::clamp(int(256 * c.b), 0, 255));
-    auto a = uint32_t(tg::clamp(int(256 * c.a), 0, 255));
-    return (a << 24) | (b << 16) | (g << 8) | r;
+    switch (align)
+    {
+    case si::style::font_align::left:
+        return 0;
+    case si::style::font_align::center:
+        return (wrap_width - line_width) / 2;
+    case si::style::font_align::right:
+        return wrap_width - line_width;
+    }
+
+    CC_UNREACHABLE("invalid font align");
+}
+
+int count_descendants(si::element_tree const& tree, si::element_tree_element const& e)
+{
+    auto cnt = e.children_count;
+    for (auto const& c : tree.children_of(e))
+        cnt += count_descendants(tree, c);
+    return cnt;
 }
 
-void add_quad(si::Default2DMerger::render_list& rl, tg::aabb2 bb, tg::color4 color, tg::aabb2 const& clip)
+// NOTE: color is packed (see StyleSheet::computed_style::packed)
+void add_quad(si::Default2DMerger::render_list& rl, tg::aabb2 bb, uint32_t c, tg::aabb2 const& clip)
 {
-    // clipping
-    auto cbb = intersection(bb, clip);
-    if (!cbb.has_value())
+    // NOTE: clipped via the scissor rect of the cmd
+    if (!intersection(bb, clip).has_value())
         return;
-    bb = cbb.value();
 
-    if (rl.cmds.empty())
+    if (rl.use_instances)
     {
-        CC_ASSERT(rl.indices.empty());
-        rl.cmds.emplace_back();
+        auto& cmd = rl.current_cmd(true, clip);
+        auto const uv = rl.full_uv_of(cmd.texture_handle);
+        auto& q = rl.add_quad_instances(1)[0];
+        q.rect = bb;
+        q.uv = {uv, uv};
+        q.color = c;
+        q.clip_idx = rl.clip_index_of(clip);
+        cmd.instances_count += 1;
+        return;
     }
 
-    auto& cmd = rl.cmds.back();
-    CC_ASSERT(cmd.indices_start + cmd.indices_count == rl.indices.size());
+    auto& cmd = rl.current_cmd(false, clip, 4);
+    auto const uv = rl.full_uv_of(cmd.texture_handle);
+    auto v = rl.add_quads(1);
+    v[0] = {{bb.min.x, bb.min.y}, uv, c};
+    v[1] = {{bb.max.x, bb.min.y}, uv, c};
+    v[2] = {{bb.min.x, bb.max.y}, uv, c};
+    v[3] = {{bb.max.x, bb.max.y}, uv, c};
 
-    auto add_vertex = [&](tg::pos2 p) -> int {
-        auto idx = int(rl.vertices.size());
-        auto& v = rl.vertices.emplace_back();
-        v.pos = p;
-        v.uv = {0, 0}; // DEBUG
-        v.color = to_rgba8(color);
-        return idx;
+    cmd.indices_count += 6;
+}
+}
+
+si::Default2DMerger::vertex* si::Default2DMerger::render_list::add_quads(size_t count)
+{
+    auto const vi = vertices.size();
+
+    // NOTE: reserve allocates exactly, so growth must be geometric here
+    //       (after the first frames, the capacity of the previous frames is usually enough)
+    auto const grow = [](auto& v, size_t size) {
+        if (size > v.capacity())
+            v.reserve(tg::max(size, v.capacity() * 2));
+        v.resize(size);
+    };
+
+    auto const write_indices = [&](auto* idx, size_t first_vertex) {
+        using index_t = std::remove_reference_t<decltype(*idx)>;
+        for (size_t q = 0; q < count; ++q)
+        {
+            auto const v = index_t(first_vertex + q * 4);
+            idx[0] = index_t(v + 0);
+            idx[1] = index_t(v + 1);
+            idx[2] = index_t(v + 3);
+            idx[3] = index_t(v + 0);
+            idx[4] = index_t(v + 3);
+            idx[5] = index_t(v + 2);
+            idx += 6;
+        }
     };
 
-    auto v00 = add_vertex({bb.min.x, bb.min.y});
-    auto v10 = add_vertex({bb.max.x, bb.min.y});
-    auto v01 = add_vertex({bb.min.x, bb.max.y});
-    auto v11 = add_vertex({bb.max.x, bb.max.y});
+    grow(vertices, vi + count * 4);
 
-    rl.indices.push_back(v00);
-    rl.indices.push_back(v10);
-    rl.indices.push_back(v11);
+    if (use_indices16)
+    {
+        CC_ASSERT(!cmds.empty() && vi + count * 4 - cmds.back().vertex_offset <= max_indices16_vertices && "current_cmd must be called before");
+        auto const ii = indices16.size();
+        grow(indices16, ii + count * 6);
+        write_indices(indices16.data() + ii, vi - cmds.back().vertex_offset);
+    }
+    else
+    {
+        auto const ii = indices.size();
+        grow(indices, ii + count * 6);
+        write_indices(indices.data() + ii, vi);
+    }
 
-    rl.indices.push_back(v00);
-    rl.indices.push_back(v11);
-    rl.indices.push_back(v01);
+    return vertices.data() + vi;
+}
 
-    cmd.indices_count += 6;
+si::Default2DMerger::quad_instance* si::Default2DMerger::render_list::add_quad_instances(size_t count)
+{
+    auto const qi = instances.size();
+    if (qi + count > instances.capacity())
+        instances.reserve(tg::max(qi + count, instances.capacity() * 2));
+
+    instances.resize(qi + count);
+    return instances.data() + qi;
 }
-// TODO: clip
-void add_quad_uv(si::Default2DMerger::render_list& rl, tg::aabb2 const& bb, tg::aabb2 const& uv, tg::color4 color)
+
+uint32_t si::Default2DMerger::render_list::clip_index_of(tg::aabb2 const& clip)
 {
-    if (rl.cmds.empty())
+    // NOTE: consecutive quads mostly share their clip rect
+    if (clip_rects.empty() || clip_rects.back() != clip)
+        clip_rects.push_back(clip);
+    return uint32_t(clip_rects.size() - 1);
+}
+
+si::Default2DMerger::draw_cmd& si::Default2DMerger::render_list::current_cmd(bool instanced, tg::aabb2 const& clip, size_t new_vertices)
+{
+    if (cmds.empty())
+        add_cmd(0, clip);
+
+    auto& cmd = cmds.back();
+
+    // 16 bit indices are relative to the vertex_offset of their cmd
+    auto const fits_indices16 = !use_indices16 || vertices.size() + new_vertices - cmd.vertex_offset <= max_indices16_vertices;
+
+    if (cmd.indices_count == 0 && cmd.instances_count == 0) // still empty
     {
-        CC_ASSERT(rl.indices.empty());
-        rl.cmds.emplace_back();
+        cmd.clip_rect = clip;
+        if (use_indices16)
+            cmd.vertex_offset = uint32_t(vertices.size());
+        return cmd;
     }
 
-    auto& cmd = rl.cmds.back();
-    CC_ASSERT(cmd.indices_start + cmd.indices_count == rl.indices.size());
+    if ((instanced ? cmd.indices_count == 0 : cmd.instances_count == 0) && cmd.clip_rect == clip && fits_indices16)
+        return cmd;
 
-    auto add_vertex = [&](tg::pos2 p, tg::pos2 uv) -> int {
-        auto idx = int(rl.vertices.size());
-        auto& v = rl.vertices.emplace_back();
-        v.pos = p;
-        v.uv = uv;
-        v.color = to_rgba8(color);
-        return idx;
-    };
+    auto& new_cmd = add_cmd(cmd.texture_handle, clip);
+    if (!fits_indices16)
+        new_cmd.vertex_offset = uint32_t(vertices.size());
+    return new_cmd;
+}
 
-    auto v00 = add_vertex({bb.min.x, bb.min.y}, {uv.min.x, uv.min.y});
-    auto v10 = add_vertex({bb.max.x, bb.min.y}, {uv.max.x, uv.min.y});
-    auto v01 = add_vertex({bb.min.x, bb.max.y}, {uv.min.x, uv.max.y});
-    auto v11 = add_vertex({bb.max.x, bb.max.y}, {uv.max.x, uv.max.y});
+si::Default2DMerger::draw_cmd& si::Default2DMerger::render_list::add_cmd(uint64_t texture_handle, tg::aabb2 const& clip)
+{
+    auto const vertex_offset = cmds.empty() ? 0u : cmds.back().vertex_offset;
+
+    auto& cmd = cmds.emplace_back();
+    cmd.texture_handle = texture_handle;
+    cmd.clip_rect = clip;
+    cmd.indices_start = uint32_t(index_count());
+    cmd.instances_start = uint32_t(instances.size());
+    cmd.vertex_offset = vertex_offset;
+    return cmd;
+}
 
-    rl.indices.push_back(v00);
-    rl.indices.push_back(v10);
-    rl.indices.push_back(v11);
+void si::Default2DMerger::render_list::quantize_vertices()
+{
+    compact_vertices.resize(vertices.size());
 
-    rl.indices.push_back(v00);
-    rl.indices.push_back(v11);
-    rl.indices.push_back(v01);
+    auto const quantize_pos = [](float f) { return int16_t(tg::clamp(int(tg::round(f * compact_pos_scale)), -32768, 32767)); };
+    auto const quantize_uv = [](float f) { return uint16_t(tg::clamp(f, 0.f, 1.f) * 65535 + 0.5f); };
 
-    cmd.indices_count += 6;
+    for (size_t i = 0; i < vertices.size(); ++i)
+    {
+        auto const& v = vertices[i];
+        auto& c = compact_vertices[i];
+        c.x = quantize_pos(v.pos.x);
+        c.y = quantize_pos(v.pos.y);
+        c.u = quantize_uv(v.uv.x);
+        c.v = quantize_uv(v.uv.y);
+        c.color = v.color;
+    }
 }
+
+uint64_t si::Default2DMerger::render_list::compute_content_hash() const
+{
+    // NOTE: all render structs are trivially copyable and have no padding
+    auto h = detail::make_hash(0x524C4953, use_instances, use_indices16, use_compact_vertices);
+    h = cc::hash_xxh3(cc::span<vertex const>(vertices).as_bytes(), h);
+    h = cc::hash_xxh3(cc::span<compact_vertex const>(compact_vertices).as_bytes(), h);
+    h = cc::hash_xxh3(cc::span<int const>(indices).as_bytes(), h);
+    h = cc::hash_xxh3(cc::span<uint16_t const>(indices16).as_bytes(), h);
+    h = cc::hash_xxh3(cc::span<quad_instance const>(instances).as_bytes(), h);
+    h = cc::hash_xxh3(cc::span<tg::aabb2 const>(clip_rects).as_bytes(), h);
+    h = cc::hash_xxh3(cc::span<draw_cmd const>(cmds).as_bytes(), h);
+    return h;
 }
 
 void si::Default2DMerger::emit_warning(si::element_handle id, cc::string_view msg)
@@ -109,58 +217,188 @@ void si::Default2DMerger::emit_warning(si::element_handle id, cc::string_view ms
     LOG_WARN("[si] {} (element id {})", msg, id.id());
 }
 
-si::element_tree_element* si::Default2DMerger::query_input_element_at(tg::pos2 p) const
+si::element_tree_element* si::Default2DMerger::query_input_element_at(tg::pos2 p)
 {
-    for (auto i = int(_layout_roots.size()) - 1; i >= 0; --i)
-        if (auto e = query_input_child_element_at(_layout_roots[i], p))
-            return e;
-    return nullptr;
+    auto const ei = query_hit_entry_at(p, true);
+    return ei < 0 ? nullptr : _layout_tree[_hit_grid.entries[ei].layout_idx].element;
 }
 
-si::element_tree_element* si::Default2DMerger::query_input_child_element_at(int layout_idx, tg::pos2 p) const
+si::Default2DMerger::layouted_element const* si::Default2DMerger::query_layout_element_at(tg::pos2 p)
 {
-    auto const& le = _layout_tree[layout_idx];
+    auto const ei = query_hit_entry_at(p, false);
+    return ei < 0 ? nullptr : &_layout_tree[_hit_grid.entries[ei].layout_idx];
+}
 
-    if (le.no_input || le.style.visibility != style::visibility::visible)
-        return nullptr; // does not receive input
+int si::Default2DMerger::query_hit_entry_at(tg::pos2 p, bool input_only)
+{
+    update_hit_grid();
 
-    if (!contains(le.bounds(), p))
-        return nullptr;
+    auto const& g = _hit_grid;
+    if (g.entries.empty() || !contains(g.bounds, p))
+        return -1;
 
-    auto cs = le.child_start;
-    auto ce = le.child_start + le.child_count;
-    for (auto i = ce - 1; i >= cs; --i)
-        if (auto e = query_input_child_element_at(i, p))
-            return e;
+    auto cx = tg::clamp(int((p.x - g.bounds.min.x) * g.inv_cell_size.x), 0, g.cells_x - 1);
+    auto cy = tg::clamp(int((p.y - g.bounds.min.y) * g.inv_cell_size.y), 0, g.cells_y - 1);
+    auto ci = cy * g.cells_x + cx;
 
-    if (!le.style.consumes_input)
-        return nullptr;
+    // back-to-front, so search backwards
+    for (auto i = g.cell_start[ci + 1] - 1; i >= g.cell_start[ci]; --i)
+    {
+        auto const ei = g.cell_entries[i];
+        auto const& e = g.entries[ei];
+        if ((e.is_input || !input_only) && contains(e.bounds, p))
+            return ei;
+    }
 
-    return le.element;
+    return -1;
 }
 
-si::Default2DMerger::layouted_element const* si::Default2DMerger::query_layout_element_at(tg::pos2 p) const
+void si::Default2DMerger::query_input_elements_in(tg::aabb2 const& rect, cc::vector<element_handle>& out)
 {
-    for (auto i = int(_layout_roots.size()) - 1; i >= 0; --i)
-        if (auto e = query_child_layout_element_at(_layout_roots[i], p))
-            return e;
-    return nullptr;
+    update_hit_grid();
+
+    auto const& g = _hit_grid;
+    if (g.entries.empty())
+        return;
+
+    auto const cell_of = [&](float v, float min, float inv, int cnt) { return tg::clamp(int((v - min) * inv), 0, cnt - 1); };
+    auto cx0 = cell_of(rect.min.x, g.bounds.min.x, g.inv_cell_size.x, g.cells_x);
+    auto cy0 = cell_of(rect.min.y, g.bounds.min.y, g.inv_cell_size.y, g.cells_y);
+    auto cx1 = cell_of(rect.max.x, g.bounds.min.x, g.inv_cell_size.x, g.cells_x);
+    auto cy1 = cell_of(rect.max.y, g.bounds.min.y, g.inv_cell_size.y, g.cells_y);
+
+    // entries can be in multiple cells
+    _tmp_hit_indices.clear();
+    for (auto cy = cy0; cy <= cy1; ++cy)
+        for (auto cx = cx0; cx <= cx1; ++cx)
+        {
+            auto ci = cy * g.cells_x + cx;
+            for (auto i = g.cell_start[ci]; i < g.cell_start[ci + 1]; ++i)
+            {
+                auto const ei = g.cell_entries[i];
+                auto const& b = g.entries[ei].bounds;
+                if (g.entries[ei].is_input && b.min.x <= rect.max.x && rect.min.x <= b.max.x && b.min.y <= rect.max.y && rect.min.y <= b.max.y)
+                    _tmp_hit_indices.push_back(ei);
+            }
+        }
+
+    std::sort(_tmp_hit_indices.begin(), _tmp_hit_indices.end());
+    auto prev_ei = -1;
+    for (auto ei : _tmp_hit_indices)
+        if (ei != prev_ei)
+        {
+            out.push_back(_layout_tree[g.entries[ei].layout_idx].element->id);
+            prev_ei = ei;
+        }
 }
 
-si::Default2DMerger::layouted_element const* si::Default2DMerger::query_child_layout_element_at(int layout_idx, tg::pos2 p) const
+void si::Default2DMerger::update_hit_grid()
 {
-    auto const& le = _layout_tree[layout_idx];
+    auto& g = _hit_grid;
+    if (g.is_valid)
+        return;
+    g.is_valid = true;
+
+    // collect entries in back-to-front order (pre-order of roots and child ranges)
+    // NOTE: explicit stack, children are pushed in reverse order
+    struct stack_entry
+    {
+        int layout_idx;
+        tg::aabb2 clip;
+        bool receives_input;
+    };
+    cc::vector<stack_entry> stack;
+    for (auto i = int(_layout_roots.size()) - 1; i >= 0; --i)
+        stack.push_back({_layout_roots[i], {{-tg::max<float>(), -tg::max<float>()}, {tg::max<float>(), tg::max<float>()}}, true});
+
+    g.entries.clear();
+    g.bounds = {{tg::max<float>(), tg::max<float>()}, {-tg::max<float>(), -tg::max<float>()}};
+    while (!stack.empty())
+    {
+        auto const se = stack.back();
+        stack.pop_back();
+
+        auto const& le = _layout_tree[se.layout_idx];
+        auto bb = le.bounds();
+        bb.min = tg::max(bb.min, se.clip.min);
+        bb.max = tg::min(bb.max, se.clip.max);
+        if (bb.min.x > bb.max.x || bb.min.y > bb.max.y)
+            continue; // children are clipped as well
+
+        auto const receives_input = se.receives_input && !le.no_input && le.is_visible();
+
+        auto& e = g.entries.emplace_back();
+        e.bounds = bb;
+        e.layout_idx = se.layout_idx;
+        e.is_input = receives_input && style_of(le).consumes_input;
+
+        g.bounds.min = tg::min(g.bounds.min, bb.min);
+        g.bounds.max = tg::max(g.bounds.max, bb.max);
+
+        for (auto i = le.child_start + le.child_count - 1; i >= le.child_start; --i)
+            stack.push_back({i, bb, receives_input});
+    }
+
+    if (g.entries.empty())
+        return;
+
+    // grid resolution
+    // TODO: adapt cell size to element density?
+    auto const cell_size = 64.f;
+    auto const [gw, gh] = tg::size_of(g.bounds);
+    g.cells_x = tg::clamp(int(gw / cell_size) + 1, 1, 256);
+    g.cells_y = tg::clamp(int(gh / cell_size) + 1, 1, 256);
+    g.inv_cell_size = {g.cells_x / tg::max(gw, 1.f), g.cells_y / tg::max(gh, 1.f)};
+
+    auto const cell_range = [&](hit_entry const& e, int& cx0, int& cy0, int& cx1, int& cy1) {
+        cx0 = tg::clamp(int((e.bounds.min.x - g.bounds.min.x) * g.inv_cell_size.x), 0, g.cells_x - 1);
+        cy0 = tg::clamp(int((e.bounds.min.y - g.bounds.min.y) * g.inv_cell_size.y), 0, g.cells_y - 1);
+        cx1 = tg::clamp(int((e.bounds.max.x - g.bounds.min.x) * g.inv_cell_size.x), 0, g.cells_x - 1);
+        cy1 = tg::clamp(int((e.bounds.max.y - g.bounds.min.y) * g.inv_cell_size.y), 0, g.cells_y - 1);
+    };
+
+    // counting sort into cells
+    // NOTE: entries are inserted in order, so each cell stays back-to-front
+    g.cell_start.clear();
+    g.cell_start.resize(g.cells_x * g.cells_y + 1);
+    for (auto const& e : g.entries)
+    {
+        int cx0, cy0, cx1, cy1;
+        cell_range(e, cx0, cy0, cx1, cy1);
+        for (auto cy = cy0; cy <= cy1; ++cy)
+            for (auto cx = cx0; cx <= cx1; ++cx)
+                ++g.cell_start[cy * g.cells_x + cx + 1];
+    }
+    for (auto i = 1; i < int(g.cell_start.size()); ++i)
+        g.cell_start[i] += g.cell_start[i - 1];
+
+    g.cell_entries.resize(g.cell_start.back());
+    _tmp_hit_indices.clear();
+    _tmp_hit_indices.resize(g.cells_x * g.cells_y); // fill cursor per cell
+    for (auto ei = 0; ei < int(g.entries.size()); ++ei)
+    {
+        int cx0, cy0, cx1, cy1;
+        cell_range(g.entries[ei], cx0, cy0, cx1, cy1);
+        for (auto cy = cy0; cy <= cy1; ++cy)
+            for (auto cx = cx0; cx <= cx1; ++cx)
+            {
+                auto ci = cy * g.cells_x + cx;
+                g.cell_entries[g.cell_start[ci] + _tmp_hit_indices[ci]++] = ei;
+            }
+    }
+}
 
-    if (!contains(le.bounds(), p))
-        return nullptr; // TODO: proper handling of extended children (like in context menus)
+si::Default2DMerger::layouted_element const* si::Default2DMerger::get_layout_element_of(si::element_tree const& tree, si::element_tree_element const& e) const
+{
+    auto const idx = int(&e - tree.all_elements().data());
+    if (idx < 0 || idx >= int(_element_layout_idx.size()))
+        return nullptr;
 
-    auto cs = le.child_start;
-    auto ce = le.child_start + le.child_count;
-    for (auto i = ce - 1; i >= cs; --i)
-        if (auto e = query_child_layout_element_at(i, p))
-            return e;
+    auto const li = _element_layout_idx[idx];
+    if (li < 0 || _layout_tree[li].element != &e)
+        return nullptr; // not layouted or not the merged tree
 
-    return &le;
+    return &_layout_tree[li];
 }
 
 si::Default2DMerger::Default2DMerger()
@@ -178,18 +416,39 @@ si::element_tree si::Default2DMerger::operator()(si::element_tree const& prev_ui
     _prev_ui = &prev_ui;
     _input = &input;
     _layout_tree.clear();
+    _hit_grid.is_valid = false;
     _layout_roots.clear();
     _layout_detached_roots.clear();
     _layout_original_roots = 0;
     _deferred_placements.clear();
-    _style_stack_keys.clear();
     _is_in_text_edit = false;
+    _stats_styles_reused = 0;
+    _text_metrics.next_frame();
+    _glyph_runs.next_frame();
+    _glyph_atlas.next_frame();
+    _text_words.next_frame();
+    _wrapped_texts.next_frame();
+
+    // step 0.25: invalidate interned styles if the style sheet changed
+    if (_style_table_version != _stylesheet.get_version())
+    {
+        _style_table.clear();
+        _style_table_idx.clear();
+        _prev_style_slots.clear();
+        _prev_layout_slots.clear(); // style indices are part of the layout inputs
+        _style_table_version = _stylesheet.get_version();
+    }
 
     // step 0.5: root style
+    // NOTE: is not interned in _style_table_idx because it is never queried by elements
+    //       (is rewritten every frame because it depends on the viewport)
     auto t0 = std::chrono::high_resolution_clock::now();
     auto [ww, wh] = tg::size_of(viewport);
-    auto root_style = _stylesheet.query_style(element_type::root, 0, {});
-    root_style.font.size.resolve(_font.ref_size, _font.ref_size);
+    if (_style_table.empty())
+        _style_table.emplace_back();
+    auto& root_style = _style_table[0];
+    root_style = _stylesheet.query_style(element_type::root, 0, {});
+    root_style.font.size.resolve(_font->ref_size, _font->ref_size);
     root_style.bounds.width = ww;
     root_style.bounds.height = wh;
     root_style.bounds.left = 0;
@@ -200,10 +459,18 @@ si::element_tree si::Default2DMerger::operator()(si::element_tree const& prev_ui
 
     // step 1: style
     {
-        _layout_tree.reserve(ui.all_elements().size()); // might be reshuffled but is max size
-        _layout_tree.resize(ui.roots().size());         // pre-alloc roots as there is no perform_layout for them
+        // slots of last frame are kept for reusing styles
+        std::swap(_style_slots, _prev_style_slots);
+        _style_slots.clear();
+        _style_slots.resize(ui.all_elements().size());
+
+        _element_layout_idx.clear();
+        _element_layout_idx.resize(ui.all_elements().size(), -1);
+
+        // windows are the only elements whose properties are changed during styling
+        prepare_windows(ui);
 
-        compute_child_style(ui, -1, ui.roots(), root_style, input.hovers_last);
+        compute_root_style(ui, input.hovers_last);
         CC_ASSERT(_layout_original_roots <= int(ui.roots().size()));
 
         // finalize roots
@@ -221,7 +488,11 @@ si::element_tree si::Default2DMerger::operator()(si::element_tree const& prev_ui
         resolve_layout_new(ui);
 
         // resolve constraints
-        resolve_deferred_placements(ui);
+        resolve_deferred_placements();
+        apply_pending_moves(ui);
+
+        // keep final layout for the next frame
+        store_layout_slots();
     }
     auto t2 = std::chrono::high_resolution_clock::now();
     _seconds_layout = std::chrono::duration<double>(t2 - t1).count();
@@ -241,17 +512,31 @@ si::element_tree si::Default2DMerger::operator()(si::element_tree const& prev_ui
             input.direct_hover_curr = input.direct_hover_last;
             input.hovers_curr = input.hovers_last;
         }
+        // same mouse pos and layout as the last search? copy its result
+        else if (_hover_cache_generation == _layout_generation && _hover_cache_pos == mouse_pos)
+        {
+            input.direct_hover_curr = _hover_cache_direct;
+            input.hovers_curr = _hover_cache_stack;
+        }
         // otherwise search topmost
-        else if (auto hc = query_input_element_at(mouse_pos))
+        else
         {
-            input.direct_hover_curr = hc->id;
-
-            // build hover stack
-            while (hc)
+            if (auto hc = query_input_element_at(mouse_pos))
             {
-                input.hovers_curr.push_back(hc->id);
-                hc = ui.parent_of(*hc);
+                input.direct_hover_curr = hc->id;
+
+                // build hover stack
+                while (hc)
+                {
+                    input.hovers_curr.push_back(hc->id);
+                    hc = ui.parent_of(*hc);
+                }
             }
+
+            _hover_cache_pos = mouse_pos;
+            _hover_cache_generation = _layout_generation;
+            _hover_cache_direct = input.direct_hover_curr;
+            _hover_cache_stack = input.hovers_curr;
         }
 
         // update focus
@@ -306,13 +591,127 @@ si::element_tree si::Default2DMerger::operator()(si::element_tree const& prev_ui
 
     // step 4: render data
     {
-        // TODO: reuse memory
+        std::swap(_paint_records, _prev_paint_records);
+        _paint_records.clear();
+
+        // one list per layout root
+        // NOTE: lists are taken over from the last frame (by root id), so they are presized and can be compared
+        std::swap(_render_data.lists, _prev_render_lists);
+        std::swap(_render_list_states, _prev_render_list_states);
         _render_data.lists.clear();
-        _render_data.lists.emplace_back();
+        _render_list_states.clear();
+
+        _prev_render_list_idx.clear();
+        for (auto i = 0; i < int(_prev_render_lists.size()); ++i)
+            _prev_render_list_idx[_prev_render_lists[i].id] = i;
+
+        // opaque background regions of roots
+        // NOTE: borders are not considered (they might be translucent)
+        _occluders.clear();
+        _occluders_start = 0;
+        _stats_occluded_elements = 0;
+        if (occlusion_culling)
+            for (auto ri = 0; ri < int(_layout_roots.size()); ++ri)
+            {
+                auto const& root = _layout_tree[_layout_roots[ri]];
+                auto const& rs = style_of(root);
+                if (!root.is_visible() || rs.bg.color.a < 1)
+                    continue;
+
+                auto r = root.bounds();
+                r.min.x += rs.border.left.get();
+                r.max.x -= rs.border.right.get();
+                r.min.y += rs.border.top.get();
+                r.max.y -= rs.border.bottom.get();
+                if (auto rc = intersection(r, viewport); rc.has_value())
+                    _occluders.push_back({ri, rc.value()});
+            }
+
+        // roots whose inputs did not change keep their list (and paint records) from the last frame
+        // NOTE: decided before building anything so that the glyph pages of reused lists are touched
+        //       before building other lists could evict them
+        _stats_render_lists_reused = 0;
+        for (auto ri = 0; ri < int(_layout_roots.size()); ++ri)
+        {
+            auto const& root = _layout_tree[_layout_roots[ri]];
+            auto& rs = _render_list_states.emplace_back();
+            rs.input_hash = compute_render_input_hash(ui, ri);
+
+            auto prev_idx = -1;
+            if (rs.input_hash == 0 || !_prev_render_list_idx.get_to(root.element->id.id(), prev_idx) || prev_idx < 0
+                || _prev_render_list_states[prev_idx].input_hash != rs.input_hash)
+                continue;
+
+            rs.is_reused = true;
+            if (_glyph_atlas.is_loaded())
+                for (auto const& cmd : _prev_render_lists[prev_idx].cmds)
+                    if (cmd.texture_handle != 0)
+                        _glyph_atlas.touch_page(int(cmd.texture_handle - 1)); // see glyph_page_texture
+        }
 
         // contains normal ui elements and detached ones
-        for (auto i : _layout_roots)
-            build_render_data(ui, _layout_tree[i], viewport);
+        for (auto ri = 0; ri < int(_layout_roots.size()); ++ri)
+        {
+            auto const& root = _layout_tree[_layout_roots[ri]];
+
+            // only roots above occlude
+            while (_occluders_start < _occluders.size() && _occluders[_occluders_start].root_pos <= ri)
+                ++_occluders_start;
+
+            auto const id = root.element->id.id();
+
+            auto& rl = _render_data.lists.emplace_back();
+            auto& rs = _render_list_states[ri];
+            auto prev_idx = -1;
+            if (_prev_render_list_idx.get_to(id, prev_idx) && prev_idx >= 0)
+            {
+                rl = cc::move(_prev_render_lists[prev_idx]);
+                _prev_render_list_idx[id] = -1; // taken
+            }
+
+            if (rs.is_reused && prev_idx >= 0)
+            {
+                auto const& prev = _prev_render_list_states[prev_idx];
+                rs.paint_start = int(_paint_records.size());
+                rs.paint_count = prev.paint_count;
+                rs.occluded_elements = prev.occluded_elements;
+                for (auto pi = prev.paint_start; pi < prev.paint_start + prev.paint_count; ++pi)
+                    _paint_records.push_back(_prev_paint_records[pi]);
+
+                rl.is_changed = false;
+                _stats_occluded_elements += rs.occluded_elements;
+                ++_stats_render_lists_reused;
+                continue;
+            }
+            rs.is_reused = false; // e.g. two roots with the same id
+
+            auto const prev_hash = rl.content_hash;
+            rl.clear();
+            rl.id = id;
+            rl.use_instances = instanced_quads;
+            rl.use_indices16 = compact_indices;
+            rl.use_compact_vertices = quantized_vertices;
+            rl.font_atlas_full_uv = _font->full_uv;
+            rl.glyph_page_full_uv = _glyph_atlas.full_uv();
+
+            rs.paint_start = int(_paint_records.size());
+            auto const occluded_before = _stats_occluded_elements;
+
+            build_render_data(ui, root, viewport);
+
+            rs.paint_count = int(_paint_records.size()) - rs.paint_start;
+            rs.occluded_elements = _stats_occluded_elements - occluded_before;
+
+            auto& built = _render_data.lists.back();
+            if (built.use_compact_vertices)
+                built.quantize_vertices();
+            built.content_hash = built.compute_content_hash();
+            built.is_changed = prev_idx < 0 || built.content_hash != prev_hash;
+        }
+
+        _prev_render_lists.clear();
+
+        update_dirty_rects();
     }
     auto t4 = std::chrono::high_resolution_clock::now();
     _seconds_render_data = std::chrono::duration<double>(t4 - t3).count();
@@ -324,84 +723,666 @@ si::element_tree si::Default2DMerger::operator()(si::element_tree const& prev_ui
     return cc::move(ui);
 }
 
-void si::Default2DMerger::set_editable_text_glyphs(cc::string_view txt, float x, float y, const si::style::font& font)
+void si::Default2DMerger::set_editable_text_glyphs(cc::string_view txt, float x, float y, const si::style::font& font, float wrap_width)
 {
     // TODO: reuse memory?
     cc::vector<merger::editable_text::glyph> glyphs;
 
-    auto s = font.size.absolute / _font.ref_size;
+    auto const add_line = [&](cc::string_view line, size_t offset, float lx, float ly) {
+        auto const& run = get_glyph_run(line, font);
+        for (auto const& c : detail::utf8_chars(line))
+            glyphs.push_back({offset + c.start, c.count, {{lx + run.char_x[c.start], ly}, {lx + run.char_x[c.start + c.count], ly + run.height}}});
+    };
 
-    size_t idx = 0;
-    for (auto c : txt)
+    if (wrap_width < 0)
+        add_line(txt, 0, x, y);
+    else
     {
-        if (c < ' ' || int(c) >= int(_font.glyphs.size()))
-            c = '?';
+        auto const& wt = get_wrapped_text(nullptr, txt, font, wrap_width);
+        auto const lh = line_height_of(font);
+        auto const add_gap = [&](size_t start, size_t end, tg::pos2 p) {
+            for (auto const& c : detail::utf8_chars(txt.subview(start, end - start)))
+                glyphs.push_back({start + c.start, c.count, {p, p + tg::vec2(0, lh)}});
+        };
+
+        // NOTE: chars between lines (spaces and '\n') are zero-width at the end of the previous line
+        auto gap_pos = tg::pos2(x, y);
+        size_t end = 0;
+        for (auto i = 0; i < int(wt.lines.size()); ++i)
+        {
+            auto const& l = wt.lines[i];
+            auto lx = x + line_align_offset(font.align, wrap_width, l.width);
+            auto ly = y + i * lh;
 
-        auto const& g = _font.glyphs[c];
-        glyphs.push_back({idx, 1, {{x, y}, {x + g.advance * s, y + _font.baseline_height * s}}});
-        x += g.advance * s;
+            add_gap(end, l.start, i == 0 ? tg::pos2(lx, ly) : gap_pos);
+            add_line(txt.subview(l.start, l.count), l.start, lx, ly);
 
-        ++idx;
+            end = l.start + l.count;
+            gap_pos = {lx + l.width, ly};
+        }
+        add_gap(end, txt.size(), gap_pos);
     }
 
     _editable_text.set_glyphs(cc::move(glyphs));
 }
 
+float si::Default2DMerger::line_height_of(style::font const& font) const
+{
+    if (_glyph_atlas.is_loaded())
+        return _glyph_atlas.line_height(font.size.absolute);
+
+    return _font->baseline_height * font.size.absolute / _font->ref_size;
+}
+
 tg::aabb2 si::Default2DMerger::get_text_bounds(cc::string_view txt, float x, float y, style::font const& font)
 {
-    auto s = font.size.absolute / _font.ref_size;
     auto ox = x;
 
-    for (auto c : txt)
+    if (_glyph_atlas.is_loaded())
     {
-        if (c < ' ' || int(c) >= int(_font.glyphs.size()))
-            c = '?';
+        // NOTE: only reads font metrics, does not rasterize (called during parallel styling)
+        merger::glyph_atlas::codepoint_metrics prev;
+        for (auto const& c : detail::utf8_chars(txt))
+        {
+            auto const m = _glyph_atlas.metrics_of(c.codepoint);
+            x += _glyph_atlas.kerning(prev, m, font.size.absolute);
+            x += _glyph_atlas.advance(m, font.size.absolute);
+            prev = m;
+        }
+    }
+    else
+    {
+        auto s = font.size.absolute / _font->ref_size;
+        for (auto const& c : detail::utf8_chars(txt))
+            x += _font->glyph_of(c.codepoint).advance * s;
+    }
+
+    return {{ox, y}, {x, y + line_height_of(font)}};
+}
 
-        x += _font.glyphs[c].advance * s;
+uint64_t si::Default2DMerger::text_key(cc::string_view txt, style::font const& font) const
+{
+    return detail::make_hash(0x54455854, _font_id, font.size.absolute, txt);
+}
+
+si::Default2DMerger::text_metrics si::Default2DMerger::measure_text(style_context& ctx, cc::string_view txt, style::font const& font)
+{
+    auto const key = text_key(txt, font);
+
+    if (ctx.is_parallel)
+    {
+        if (auto m = _text_metrics.peek(key))
+        {
+            ctx.touched_text_keys.push_back(key);
+            return *m;
+        }
     }
+    else if (auto m = _text_metrics.get(key))
+        return *m;
 
-    return {{ox, y}, {x, y + _font.baseline_height * s}};
+    auto bb = get_text_bounds(txt, 0.f, 0.f, font);
+    CC_ASSERT(bb.min.x == 0 && bb.min.y == 0); // otherwise something is fishy
+
+    text_metrics m;
+    m.width = bb.max.x - bb.min.x;
+    m.height = bb.max.y - bb.min.y;
+
+    if (ctx.is_parallel)
+        ctx.new_text_metrics.push_back({key, m});
+    else
+        _text_metrics.insert(key, m);
+
+    return m;
 }
 
-void si::Default2DMerger::add_text_render_data(render_list& rl, cc::string_view txt, float x, float y, style::font const& font, tg::aabb2 const&, size_t selection_start, size_t selection_count)
+float si::Default2DMerger::char_advance(merger::glyph_atlas::codepoint_metrics& prev, char32_t codepoint, style::font const& font) const
 {
-    auto s = font.size.absolute / _font.ref_size;
+    if (_glyph_atlas.is_loaded())
+    {
+        auto const m = _glyph_atlas.metrics_of(codepoint);
+        auto const adv = _glyph_atlas.kerning(prev, m, font.size.absolute) + _glyph_atlas.advance(m, font.size.absolute);
+        prev = m;
+        return adv;
+    }
+
+    return _font->glyph_of(codepoint).advance * font.size.absolute / _font->ref_size;
+}
 
-    // TODO: clip
+si::Default2DMerger::text_words si::Default2DMerger::compute_text_words(cc::string_view txt, style::font const& font) const
+{
+    text_words tw;
+
+    auto x = 0.f;
+    merger::glyph_atlas::codepoint_metrics prev;
+    auto in_word = false;
+    auto line_has_words = false;
+    for (auto const& c : detail::utf8_chars(txt))
+    {
+        auto const x_before = x;
+        x += char_advance(prev, c.codepoint, font);
+
+        if (c.codepoint == '\n')
+        {
+            // NOTE: only lines without any word get an (empty) word of their own
+            //       trailing spaces are skipped like everywhere else
+            if (!line_has_words)
+                tw.words.push_back({int(c.start), int(c.start), x_before, x_before});
+
+            auto& w = tw.words.back();
+            if (in_word)
+            {
+                w.end = int(c.start);
+                w.x_end = x_before;
+            }
+            w.is_line_end = true;
+            in_word = false;
+            line_has_words = false;
+        }
+        else if (c.codepoint == ' ' || c.codepoint == '\t')
+        {
+            if (in_word)
+            {
+                auto& w = tw.words.back();
+                w.end = int(c.start);
+                w.x_end = x_before;
+                in_word = false;
+            }
+        }
+        else if (!in_word)
+        {
+            tw.words.push_back({int(c.start), int(c.start), x_before, x_before});
+            in_word = true;
+            line_has_words = true;
+        }
+    }
+
+    if (in_word)
+    {
+        auto& w = tw.words.back();
+        w.end = int(txt.size());
+        w.x_end = x;
+    }
+
+    return tw;
+}
+
+si::Default2DMerger::wrapped_text si::Default2DMerger::compute_wrapped_text(text_words const& tw, style::font const& font, float max_width) const
+{
+    wrapped_text wt;
+
+    auto const& words = tw.words;
+    auto const add_line = [&](int first, int last) {
+        auto& l = wt.lines.emplace_back();
+        l.start = words[first].start;
+        l.count = words[last].end - l.start;
+        l.width = words[last].x_end - words[first].x_start;
+        wt.width = tg::max(wt.width, l.width);
+    };
+
+    // greedy: as many words per line as fit
+    // NOTE: words that are wider than max_width get their own line
+    auto first = -1;
+    for (auto i = 0; i < int(words.size()); ++i)
+    {
+        auto const& w = words[i];
+        if (first >= 0 && w.x_end - words[first].x_start > max_width)
+        {
+            add_line(first, i - 1);
+            first = -1;
+        }
+
+        if (first < 0)
+            first = i;
+
+        if (w.is_line_end)
+        {
+            add_line(first, i);
+            first = -1;
+        }
+    }
+    if (first >= 0)
+        add_line(first, int(words.size()) - 1);
+
+    wt.height = tg::max(1, int(wt.lines.size())) * line_height_of(font);
+    return wt;
+}
+
+si::Default2DMerger::wrapped_text const& si::Default2DMerger::get_wrapped_text(text_cache_updates* updates, cc::string_view txt, style::font const& font, float max_width)
+{
+    auto const words_key = text_key(txt, font);
+    auto const key = detail::make_hash(words_key, max_width);
+
+    if (updates)
+    {
+        if (auto wt = _wrapped_texts.peek(key))
+        {
+            updates->touched_keys.push_back(key);
+            return *wt;
+        }
+
+        // NOTE: words are width-independent, so a new width only re-wraps
+        auto words = _text_words.peek(words_key);
+        if (words)
+            updates->touched_keys.push_back(words_key);
+        else
+            words = &updates->new_words.emplace_back(words_key, compute_text_words(txt, font)).second;
+
+        return updates->new_wrapped.emplace_back(key, compute_wrapped_text(*words, font, max_width)).second;
+    }
+
+    if (auto wt = _wrapped_texts.get(key))
+        return *wt;
+
+    auto words = _text_words.get(words_key);
+    if (!words)
+        words = &_text_words.insert(words_key, compute_text_words(txt, font));
+
+    return _wrapped_texts.insert(key, compute_wrapped_text(*words, font, max_width));
+}
+
+void si::Default2DMerger::merge_text_cache_updates(text_cache_updates& updates)
+{
+    for (auto key : updates.touched_keys)
+    {
+        _text_words.touch(key);
+        _wrapped_texts.touch(key);
+    }
+    for (auto& [key, tw] : updates.new_words)
+        _text_words.insert(key, cc::move(tw));
+    for (auto& [key, wt] : updates.new_wrapped)
+        _wrapped_texts.insert(key, cc::move(wt));
+    updates.clear();
+}
+
+si::Default2DMerger::glyph_run const& si::Default2DMerger::get_glyph_run(cc::string_view txt, style::font const& font)
+{
+    // cached runs refer to evicted glyph atlas pages
+    if (_glyph_runs_evictions != _glyph_atlas.eviction_count())
+    {
+        _glyph_runs.clear();
+        _glyph_runs_evictions = _glyph_atlas.eviction_count();
+    }
+
+    auto const key = text_key(txt, font);
+    if (auto run = _glyph_runs.get(key))
+        return *run;
+
+    glyph_run run;
+    run.height = line_height_of(font);
+    run.char_x.reserve(txt.size() + 1);
 
     // baseline
-    auto bx = x;
-    auto by = y + _font.ascender * s;
+    auto bx = 0.f;
+    auto is_complete = true;
+
+    if (_glyph_atlas.is_loaded())
+    {
+        auto const size = font.size.absolute;
+        auto const by = _glyph_atlas.ascender(size);
+        auto const gs = _glyph_atlas.glyph_scale(size); // != 1 for distance fields
 
-    auto fc = font.color;
-    auto sc = (fc.r + fc.g + fc.b) / 3 > 0.5f ? tg::color3::black : tg::color3::white;
+        merger::glyph_atlas::codepoint_metrics prev;
+        for (auto const& c : detail::utf8_chars(txt))
+        {
+            auto const m = _glyph_atlas.metrics_of(c.codepoint);
+            bx += _glyph_atlas.kerning(prev, m, size);
+            prev = m;
 
-    size_t idx = 0;
-    for (auto c : txt)
+            auto advance = 0.f;
+            if (auto g = _glyph_atlas.get_glyph(c.codepoint, size))
+            {
+                if (g->page >= 0) // ignore invisible chars
+                {
+                    auto pmin = tg::pos2(bx + g->bearingX * gs, by - g->bearingY * gs);
+                    auto pmax = pmin + tg::vec2(g->width * gs, g->height * gs);
+                    run.quads.push_back({{pmin, pmax}, g->uv, int(c.start), g->page});
+                }
+                advance = g->advance * gs;
+            }
+            else // atlas is full for this frame
+            {
+                advance = _glyph_atlas.advance(m, size);
+                is_complete = false;
+            }
+
+            // NOTE: trailing bytes of multi-byte chars are zero-width
+            run.char_x.push_back(bx);
+            bx += advance;
+            for (size_t i = 1; i < c.count; ++i)
+                run.char_x.push_back(bx);
+        }
+    }
+    else
     {
-        if (c < ' ' || int(c) >= int(_font.glyphs.size()))
-            c = '?';
+        auto s = font.size.absolute / _font->ref_size;
+        auto by = _font->ascender * s;
+
+        for (auto const& c : detail::utf8_chars(txt))
+        {
+            auto const& gi = _font->glyph_of(c.codepoint);
 
-        auto const& gi = _font.glyphs[c];
+            if (gi.height > 0) // ignore invisible chars
+            {
+                auto pmin = tg::pos2(bx + gi.bearingX * s, by - gi.bearingY * s);
+                auto pmax = pmin + tg::vec2(gi.width * s, gi.height * s);
+                run.quads.push_back({{pmin, pmax}, gi.uv, int(c.start)});
+            }
 
-        if (gi.height > 0) // ignore invisible chars
+            // NOTE: trailing bytes of multi-byte chars are zero-width
+            run.char_x.push_back(bx);
+            bx += gi.advance * s;
+            for (size_t i = 1; i < c.count; ++i)
+                run.char_x.push_back(bx);
+        }
+    }
+    run.char_x.push_back(bx);
+
+    // rasterizing may have evicted pages
+    if (_glyph_runs_evictions != _glyph_atlas.eviction_count())
+    {
+        _glyph_runs.clear();
+        _glyph_runs_evictions = _glyph_atlas.eviction_count();
+    }
+
+    // incomplete runs are rebuilt next time
+    if (!is_complete)
+    {
+        _tmp_glyph_run = cc::move(run);
+        return _tmp_glyph_run;
+    }
+
+    return _glyph_runs.insert(key, cc::move(run));
+}
+
+void si::Default2DMerger::add_text_render_data(render_list& rl,
+                                               cc::string_view txt,
+                                               float x,
+                                               float y,
+                                               style::font const& font,
+                                               tg::aabb2 const& clip,
+                                               uint32_t color,
+                                               uint32_t selected_color,
+                                               size_t selection_start,
+                                               size_t selection_count)
+{
+    auto const& run = get_glyph_run(txt, font);
+    if (run.quads.empty())
+        return;
+
+    auto const d = tg::vec2(x, y);
+    auto const instanced = rl.use_instances;
+    auto const clip_idx = instanced ? rl.clip_index_of(clip) : 0;
+
+    // NOTE: with 16 bit indices, long texts are split so that each chunk fits into a cmd
+    auto const max_quads = rl.use_indices16 && !instanced ? render_list::max_indices16_vertices / 4 : run.quads.size();
+
+    // translate and append the pre-built quads
+    auto curr_page = -2;
+    for (size_t chunk_start = 0; chunk_start < run.quads.size(); chunk_start += max_quads)
+    {
+        auto const chunk_size = tg::min(max_quads, run.quads.size() - chunk_start);
+
+        rl.current_cmd(instanced, clip, instanced ? 0 : chunk_size * 4); // NOTE: before allocating, a new cmd would start after the quads otherwise
+        auto const first_index = uint32_t(rl.index_count());
+        auto const first_instance = uint32_t(rl.instances.size());
+        auto v = instanced ? nullptr : rl.add_quads(chunk_size);
+        auto qi = instanced ? rl.add_quad_instances(chunk_size) : nullptr;
+
+        for (size_t i = 0; i < chunk_size; ++i)
         {
-            auto pmin = tg::pos2(bx + gi.bearingX * s, by - gi.bearingY * s);
-            auto pmax = pmin + tg::vec2(gi.width * s, gi.height * s);
-            auto is_sel = selection_start <= idx && idx < selection_start + selection_count;
-            add_quad_uv(rl, {pmin, pmax}, gi.uv, is_sel ? sc : fc);
+            auto const& q = run.quads[chunk_start + i];
+
+            // glyph atlas pages are separate textures
+            if (q.page != curr_page)
+            {
+                curr_page = q.page;
+                auto const texture = curr_page < 0 ? 0 : glyph_page_texture(curr_page);
+                if (curr_page >= 0)
+                    _glyph_atlas.touch_page(curr_page);
+
+                auto& cmd = rl.cmds.back();
+                if (cmd.indices_count == 0 && cmd.instances_count == 0)
+                    cmd.texture_handle = texture;
+                else if (cmd.texture_handle != texture)
+                {
+                    auto& new_cmd = rl.add_cmd(texture, clip);
+                    new_cmd.indices_start = first_index + uint32_t(i * 6);
+                    new_cmd.instances_start = first_instance + uint32_t(i);
+                }
+            }
+
+            auto is_sel = selection_start <= size_t(q.char_idx) && size_t(q.char_idx) < selection_start + selection_count;
+            auto const c = is_sel ? selected_color : color;
+
+            if (instanced)
+            {
+                qi->rect = {q.bounds.min + d, q.bounds.max + d};
+                qi->uv = q.uv;
+                qi->color = c;
+                qi->clip_idx = clip_idx;
+                ++qi;
+
+                rl.cmds.back().instances_count += 1;
+                continue;
+            }
+
+            auto const& bb = q.bounds;
+            auto const& uv = q.uv;
+            v[0] = {tg::pos2(bb.min.x, bb.min.y) + d, {uv.min.x, uv.min.y}, c};
+            v[1] = {tg::pos2(bb.max.x, bb.min.y) + d, {uv.max.x, uv.min.y}, c};
+            v[2] = {tg::pos2(bb.min.x, bb.max.y) + d, {uv.min.x, uv.max.y}, c};
+            v[3] = {tg::pos2(bb.max.x, bb.max.y) + d, {uv.max.x, uv.max.y}, c};
+            v += 4;
+
+            rl.cmds.back().indices_count += 6;
         }
+    }
+}
 
-        bx += gi.advance * s;
-        ++idx;
+void si::Default2DMerger::prepare_windows(si::element_tree& tree)
+{
+    prepare_sibling_windows(tree, tree.roots());
+    for (auto const& e : tree.all_elements())
+        if (e.children_count > 0)
+            prepare_sibling_windows(tree, tree.children_of(e));
+}
+
+void si::Default2DMerger::prepare_sibling_windows(si::element_tree& tree, cc::span<si::element_tree_element> elements)
+{
+    auto win_start_offset = 8.f;
+    auto max_window_idx = 0;
+
+    // collect windows with prev idx
+    _tmp_windows.clear();
+    for (auto& c : elements)
+        if (c.type == element_type::window)
+        {
+            // first frame
+            if (!tree.has_property(c, si::property::absolute_pos))
+            {
+                tree.set_property(c, si::property::absolute_pos, {win_start_offset, win_start_offset});
+                win_start_offset += 8.f;
+            }
+
+            auto prev_c = _prev_ui->get_element_by_id(c.id);
+            auto widx = _prev_ui->get_property_or(prev_c, si::property::detail::window_idx, max_window_idx + 1);
+            max_window_idx = tg::max(widx, max_window_idx);
+            _tmp_windows.push_back({&c, widx});
+        }
+
+    if (_tmp_windows.empty())
+        return;
+
+    // TODO: focus window to top
+
+    // sort windows and set new indices
+    std::sort(_tmp_windows.begin(), _tmp_windows.end());
+    for (auto i = 0; i < int(_tmp_windows.size()); ++i)
+        tree.set_property(*_tmp_windows[i].window, si::property::detail::window_idx, i);
+}
+
+void si::Default2DMerger::compute_root_style(si::element_tree& tree, cc::span<element_handle> hover_stack)
+{
+    auto roots = tree.roots();
+    auto const root_cnt = int(roots.size());
+
+    // collect roots in z-order
+    // .. normal/abs roots (declaration order)
+    // .. windows (sorted by window idx)
+    _style_root_jobs.clear();
+    for (auto i = 0; i < root_cnt; ++i)
+    {
+        auto& r = roots[i];
+        if (r.type == element_type::window)
+            continue;
+
+        if (tree.get_property_or(r, si::property::detached, false))
+        {
+            CC_ASSERT(tree.get_property_or(r, si::property::visibility, style::visibility::visible) == style::visibility::none
+                      && "detached elements in ui root is currently not supported");
+            continue;
+        }
+
+        CC_ASSERT(!tree.has_property(r, si::property::placement) && "normal elements may not have placement");
+        auto& job = _style_root_jobs.emplace_back();
+        job.element = &r;
+        job.child_idx = i;
+        job.child_cnt = root_cnt;
+    }
+
+    _tmp_windows.clear();
+    for (auto& r : roots)
+        if (r.type == element_type::window)
+            _tmp_windows.push_back({&r, tree.get_property(r, si::property::detail::window_idx)});
+    std::sort(_tmp_windows.begin(), _tmp_windows.end());
+    for (auto i = 0; i < int(_tmp_windows.size()); ++i)
+    {
+        auto& job = _style_root_jobs.emplace_back();
+        job.element = _tmp_windows[i].window;
+        job.child_idx = i;
+        job.child_cnt = int(_tmp_windows.size());
+    }
+
+    // allocate layout slots
+    // NOTE: each root gets a contiguous range for its whole subtree
+    //       (hidden detached elements leave holes)
+    _layout_tree.resize(tree.all_elements().size());
+    auto slot_base = root_cnt;
+    for (auto& job : _style_root_jobs)
+    {
+        job.layout_idx = add_child_layout_element(-1);
+        job.slot_start = slot_base;
+        slot_base += count_descendants(tree, *job.element);
+        job.slot_end = slot_base;
+    }
+    CC_ASSERT(slot_base <= int(_layout_tree.size()));
+
+    auto const run_job = [&](style_context& ctx, style_root_job const& job) {
+        ctx.next_layout_idx = job.slot_start;
+        ctx.end_layout_idx = job.slot_end;
+        compute_style(ctx, tree, *job.element, job.layout_idx, -1, 0, job.child_idx, job.child_cnt, hover_stack);
+    };
+
+    auto const job_cnt = int(_style_root_jobs.size());
+    auto const is_parallel = parallel_style && job_cnt > 1;
+    if (_style_contexts.empty())
+        _style_contexts.emplace_back();
+
+    if (!is_parallel)
+    {
+        auto& ctx = _style_contexts[0];
+        ctx.reset(false);
+        for (auto const& job : _style_root_jobs)
+            run_job(ctx, job);
+    }
+    else
+    {
+        if (!_workers)
+            _workers = cc::make_unique<detail::worker_pool>();
+
+        if (int(_style_contexts.size()) < job_cnt)
+            _style_contexts.resize(job_cnt);
+        for (auto i = 0; i < job_cnt; ++i)
+            _style_contexts[i].reset(true);
+
+        _workers->parallel_for(job_cnt, [&](int i) { run_job(_style_contexts[i], _style_root_jobs[i]); });
+
+        // intern new styles in root order
+        // NOTE: this is the same order in which the serial path interns them, so indices are the same
+        auto const frozen_cnt = int(_style_table.size());
+        for (auto i = 0; i < job_cnt; ++i)
+        {
+            auto& ctx = _style_contexts[i];
+            ctx.new_style_remap.resize(ctx.new_styles.size());
+            for (auto si = 0; si < int(ctx.new_styles.size()); ++si)
+            {
+                auto& style = ctx.new_styles[si];
+                int idx;
+                if (!_style_table_idx.get_to(style.hash, idx))
+                {
+                    idx = int(_style_table.size());
+                    _style_table_idx[style.hash] = idx;
+                    _style_table.push_back(cc::move(style));
+                }
+                ctx.new_style_remap[si] = idx;
+            }
+        }
+
+        // remap context-local style indices
+        _workers->parallel_for(job_cnt, [&](int i) {
+            auto const& ctx = _style_contexts[i];
+            auto const& job = _style_root_jobs[i];
+            if (ctx.new_styles.empty())
+                return;
+
+            auto const remap = [&](int& idx) {
+                if (idx >= frozen_cnt)
+                    idx = ctx.new_style_remap[idx - frozen_cnt];
+            };
+            auto const remap_slot = [&](int layout_idx) {
+                remap(_layout_tree[layout_idx].style_idx);
+                remap(_style_slots[layout_idx].style_idx);
+                remap(_style_slots[layout_idx].parent_style_idx);
+            };
+
+            remap_slot(job.layout_idx);
+            for (auto li = job.slot_start; li < job.slot_end; ++li)
+                remap_slot(li);
+        });
+    }
+
+    // chain of "normal" roots
+    auto prev_normal_idx = -1;
+    for (auto const& job : _style_root_jobs)
+        if (auto& le = _layout_tree[job.layout_idx]; le.is_normal())
+        {
+            le.prev_normal_idx = prev_normal_idx;
+            prev_normal_idx = job.layout_idx;
+        }
+
+    // collect results in root order
+    for (auto i = 0; i < (is_parallel ? job_cnt : 1); ++i)
+    {
+        auto const& ctx = _style_contexts[i];
+        for (auto idx : ctx.detached_roots)
+            _layout_detached_roots.push_back(idx);
+        for (auto const& dp : ctx.deferred_placements)
+            _deferred_placements.push_back(dp);
+        _stats_styles_reused += ctx.styles_reused;
+
+        for (auto key : ctx.touched_text_keys)
+            _text_metrics.touch(key);
+        for (auto const& [key, m] : ctx.new_text_metrics)
+            _text_metrics.insert(key, m);
     }
 }
 
-void si::Default2DMerger::compute_style(si::element_tree& tree,
+void si::Default2DMerger::compute_style(style_context& ctx,
+                                        si::element_tree& tree,
                                         si::element_tree_element& e,
                                         int layout_idx,
                                         int parent_layout_idx,
-                                        si::StyleSheet::computed_style const& parent_style,
+                                        int parent_style_idx,
                                         int child_idx,
                                         int child_cnt,
                                         cc::span<element_handle> hover_stack)
@@ -409,16 +1390,16 @@ void si::Default2DMerger::compute_style(si::element_tree& tree,
     // alloc space for children
     // children can be reordered and skipped but for now we don't support adding more
     auto const ccnt = e.children_count;
-    auto const layout_child_start = int(_layout_tree.size());
-    CC_ASSERT(_layout_tree.size() + ccnt <= _layout_tree.capacity() && "should be known a-priori");
-    _layout_tree.resize(_layout_tree.size() + ccnt);
+    auto const layout_child_start = ctx.next_layout_idx;
+    CC_ASSERT(ctx.next_layout_idx + ccnt <= ctx.end_layout_idx && "should be known a-priori");
+    ctx.next_layout_idx += ccnt;
 
     // init layout element
-    // NOTE: le stays valid because we reserved enough _layout_tree
     auto& le = _layout_tree[layout_idx];
     CC_ASSERT(le.element == nullptr && "not properly cleared?");
     CC_ASSERT(le.child_count == 0 && "not properly cleared?");
     le.element = &e;
+    _element_layout_idx[int(&e - tree.all_elements().data())] = layout_idx;
     le.child_start = layout_child_start;
     le.no_input = tree.get_property_or(e, si::property::no_input, false);
     le.parent_idx = parent_layout_idx;
@@ -436,24 +1417,46 @@ void si::Default2DMerger::compute_style(si::element_tree& tree,
     style_key.is_checked = tree.get_property_or(e, si::property::state_u8, 0) >= 1;
     style_key.is_enabled = tree.get_property_or(e, si::property::enabled, true);
     style_key.style_class = tree.get_property_or(e, si::property::style_class, 0);
-    le.style = _stylesheet.query_style(style_key, parent_style.hash, _style_stack_keys);
+
+    // reuse style of last frame if this slot has the same inputs
+    // otherwise query the (interned) style
+    auto& slot = _style_slots[layout_idx];
+    slot.key = style_key;
+    slot.parent_style_idx = parent_style_idx;
+    if (layout_idx < int(_prev_style_slots.size()) && _prev_style_slots[layout_idx].has_same_input(slot))
+    {
+        slot.style_idx = _prev_style_slots[layout_idx].style_idx;
+        ++ctx.styles_reused;
+    }
+    else
+        slot.style_idx = query_style_idx(ctx, style_key, parent_style_idx);
+    le.style_idx = slot.style_idx;
+
+    // NOTE: reference is only valid until the next query_style_idx (i.e. the children)
+    auto const& style = style_at(ctx, le.style_idx);
 
     // overwritable style
-    le.style.visibility = tree.get_property_or(e, si::property::visibility, le.style.visibility);
+    auto& ls = le.local_style;
+    ls.left = style.bounds.left;
+    ls.top = style.bounds.top;
+    ls.width = style.bounds.width;
+    ls.height = style.bounds.height;
+    ls.positioning = style.positioning;
+    ls.visibility = tree.get_property_or(e, si::property::visibility, style.visibility);
 
     tg::pos2 abs_pos;
     if (tree.get_property_to(e, si::property::absolute_pos, abs_pos))
     {
-        le.style.positioning = style::positioning::absolute;
-        le.style.bounds.left = abs_pos.x;
-        le.style.bounds.top = abs_pos.y;
+        ls.positioning = style::positioning::absolute;
+        ls.left = abs_pos.x;
+        ls.top = abs_pos.y;
     }
 
     tg::size2 fixed_size;
     if (tree.get_property_to(e, si::property::fixed_size, fixed_size))
     {
-        le.style.bounds.width = fixed_size.width;
-        le.style.bounds.height = fixed_size.height;
+        ls.width = fixed_size.width;
+        ls.height = fixed_size.height;
     }
 
     tree.get_property_each(e, si::property::style_value, [&](style::style_value const& v) {
@@ -461,28 +1464,28 @@ void si::Default2DMerger::compute_style(si::element_tree& tree,
         switch (v.entry)
         {
         case style_entry::left_abs:
-            le.style.bounds.left = v.value;
+            ls.left = v.value;
             break;
         case style_entry::left_rel:
-            le.style.bounds.left.set_relative(v.value);
+            ls.left.set_relative(v.value);
             break;
         case style_entry::top_abs:
-            le.style.bounds.top = v.value;
+            ls.top = v.value;
             break;
         case style_entry::top_rel:
-            le.style.bounds.top.set_relative(v.value);
+            ls.top.set_relative(v.value);
             break;
         case style_entry::width_abs:
-            le.style.bounds.width = v.value;
+            ls.width = v.value;
             break;
         case style_entry::width_rel:
-            le.style.bounds.width.set_relative(v.value);
+            ls.width.set_relative(v.value);
             break;
         case style_entry::height_abs:
-            le.style.bounds.height = v.value;
+            ls.height = v.value;
             break;
         case style_entry::height_rel:
-            le.style.bounds.height.set_relative(v.value);
+            ls.height.set_relative(v.value);
             break;
         case style_entry::invalid:
             CC_UNREACHABLE("invalid style entry");
@@ -490,38 +1493,27 @@ void si::Default2DMerger::compute_style(si::element_tree& tree,
         }
     });
 
-    // "resolve" style
-    le.style.font.size.resolve(_font.ref_size, parent_style.font.size.absolute);
-    CC_ASSERT(!le.style.border.left.has_percentage() && "not supported");
-    CC_ASSERT(!le.style.border.right.has_percentage() && "not supported");
-    CC_ASSERT(!le.style.border.top.has_percentage() && "not supported");
-    CC_ASSERT(!le.style.border.bottom.has_percentage() && "not supported");
-    le.style.border.left.resolve(0, 0);
-    le.style.border.right.resolve(0, 0);
-    le.style.border.top.resolve(0, 0);
-    le.style.border.bottom.resolve(0, 0);
-
     // prepare text
     if (tree.has_property(e, si::property::text))
     {
         le.has_text = true;
         auto txt = tree.get_property(e, si::property::text);
-        auto bb = get_text_bounds(txt, 0.f, 0.f, le.style.font);
-        CC_ASSERT(bb.min.x == 0 && bb.min.y == 0); // otherwise something is fishy
-        le.text_width = bb.max.x - bb.min.x;
-        le.text_height = bb.max.y - bb.min.y;
+        auto m = measure_text(ctx, txt, style.font);
+        le.text_width = m.width;
+        le.text_height = m.height;
     }
 
     // compute child style
-    _style_stack_keys.push_back(style_key);
-    compute_child_style(tree, layout_idx, tree.children_of(e), le.style, hover_stack.empty() ? hover_stack : hover_stack.first(hover_stack.size() - 1));
-    _style_stack_keys.pop_back();
+    ctx.stack_keys.push_back(style_key);
+    compute_child_style(ctx, tree, layout_idx, tree.children_of(e), le.style_idx, hover_stack.empty() ? hover_stack : hover_stack.first(hover_stack.size() - 1));
+    ctx.stack_keys.pop_back();
 }
 
-void si::Default2DMerger::compute_child_style(si::element_tree& tree,
+void si::Default2DMerger::compute_child_style(style_context& ctx,
+                                              si::element_tree& tree,
                                               int parent_layout_idx,
                                               cc::span<si::element_tree_element> elements,
-                                              si::StyleSheet::computed_style const& style,
+                                              int style_idx,
                                               cc::span<element_handle> hover_stack)
 {
     /*
@@ -530,13 +1522,13 @@ void si::Default2DMerger::compute_child_style(si::element_tree& tree,
      * we reorder the children to get the actual z order (render order)
      * currently there are three types of children (in this order):
      * .. normal/abs elements (most frequent ones, declaration order)
-     * .. windows (sorted by window idx)
+     * .. windows (sorted by window idx, see prepare_windows)
      * .. detached (new roots, not part of parent's children, occupy last slots
      */
 
-    auto win_start_offset = 8.f;
+    CC_ASSERT(parent_layout_idx >= 0 && "roots are handled in compute_root_style");
+
     auto has_windows = false;
-    auto max_window_idx = 0;
 
     auto detached_cnt = 0;
 
@@ -553,24 +1545,14 @@ void si::Default2DMerger::compute_child_style(si::element_tree& tree,
         auto is_detached = tree.get_property_or(c, si::property::detached, false);
         auto is_placed = tree.get_property_to(c, si::property::placement, placement);
 
-        // persistent window index handling
+        // windows are layout later in this function
         if (c.type == element_type::window)
         {
-            // first frame
-            if (!tree.has_property(c, si::property::absolute_pos))
-            {
-                tree.set_property(c, si::property::absolute_pos, {win_start_offset, win_start_offset});
-                win_start_offset += 8.f;
-            }
-
-            // windows are layout later in this function
             has_windows = true;
         }
         // detached (tooltips, popups, etc.)
         else if (is_detached)
         {
-            CC_ASSERT(parent_layout_idx >= 0 && "detached elements in ui root is currently not supported");
-
             // ignore vis none
             // NOTE: does not account for implicitly "none" yet
             if (tree.get_property_or(c, si::property::visibility, style::visibility::visible) != style::visibility::none)
@@ -582,20 +1564,20 @@ void si::Default2DMerger::compute_child_style(si::element_tree& tree,
 
                 // new layout root
                 // NOTE: BEFORE recursing (for proper nested tooltips/popovers)
-                _layout_detached_roots.push_back(cidx);
+                ctx.detached_roots.push_back(cidx);
 
                 // NOTE: BEFORE recursing (for proper nested tooltips/popovers)
                 if (is_placed)
-                    _deferred_placements.push_back({placement, parent_layout_idx, cidx});
+                    ctx.deferred_placements.push_back({placement, parent_layout_idx, cidx});
 
-                compute_style(tree, c, cidx, parent_layout_idx, style, 0, 0, hover_stack);
+                compute_style(ctx, tree, c, cidx, parent_layout_idx, style_idx, 0, 0, hover_stack);
             }
         }
         else
         {
             CC_ASSERT(!is_placed && "normal elements may not have placement");
             auto cidx = add_child_layout_element(parent_layout_idx);
-            compute_style(tree, c, cidx, parent_layout_idx, style, child_idx, child_cnt, hover_stack);
+            compute_style(ctx, tree, c, cidx, parent_layout_idx, style_idx, child_idx, child_cnt, hover_stack);
 
             // chain of "normal" siblings
             if (auto& le = _layout_tree[cidx]; le.is_normal())
@@ -607,38 +1589,89 @@ void si::Default2DMerger::compute_child_style(si::element_tree& tree,
     }
 
     // window sorting
-    // NOTE: _tmp_windows can only be used here because recursive layouts would clear it again otherwise
+    // NOTE: ctx.tmp_windows is used as a stack because nested windows are styled recursively
     if (has_windows)
     {
-        // TODO: focus window to top
-
-        // collect windows with prev idx
-        _tmp_windows.clear();
+        auto const win_start = int(ctx.tmp_windows.size());
         for (auto& c : elements)
             if (c.type == element_type::window)
-            {
-                auto prev_c = _prev_ui->get_element_by_id(c.id);
-                auto widx = _prev_ui->get_property_or(prev_c, si::property::detail::window_idx, max_window_idx + 1);
-                max_window_idx = tg::max(widx, max_window_idx);
-                _tmp_windows.push_back({&c, widx});
-            }
+                ctx.tmp_windows.push_back({&c, tree.get_property(c, si::property::detail::window_idx)});
 
-        // sort windows
-        std::sort(_tmp_windows.begin(), _tmp_windows.end());
+        std::sort(ctx.tmp_windows.begin() + win_start, ctx.tmp_windows.end());
 
-        // perform layouting and set new indices
-        for (auto i = 0; i < int(_tmp_windows.size()); ++i)
+        // perform layouting
+        // NOTE: index access as the stack grows while recursing
+        auto const win_cnt = int(ctx.tmp_windows.size()) - win_start;
+        for (auto i = 0; i < win_cnt; ++i)
         {
-            auto& c = *_tmp_windows[i].window;
+            auto& c = *ctx.tmp_windows[win_start + i].window;
 
             auto cidx = add_child_layout_element(parent_layout_idx);
-            compute_style(tree, c, cidx, parent_layout_idx, style, i, int(_tmp_windows.size()), hover_stack);
-
-            tree.set_property(c, si::property::detail::window_idx, i);
+            compute_style(ctx, tree, c, cidx, parent_layout_idx, style_idx, i, win_cnt, hover_stack);
         }
+
+        ctx.tmp_windows.resize(win_start);
     }
 }
 
+int si::Default2DMerger::query_style_idx(style_context& ctx, si::StyleSheet::style_key key, int parent_style_idx)
+{
+    auto const& parent_style = style_at(ctx, parent_style_idx);
+    auto const parent_hash = parent_style.hash;
+    auto const hash = StyleSheet::hash_of(key, parent_hash);
+
+    int idx;
+    if (_style_table_idx.get_to(hash, idx))
+        return idx;
+
+    // NOTE: must be copied as emplace_back can invalidate the parent style
+    auto const parent_font_size = parent_style.font.size.absolute;
+
+    // parallel: _style_table is shared and must not be modified
+    //           so new styles are collected per context and merged afterwards
+    //           (StyleSheet::compute_style is used as query_style modifies the style cache)
+    if (ctx.is_parallel)
+    {
+        if (ctx.new_style_idx.get_to(hash, idx))
+            return idx;
+
+        idx = int(_style_table.size() + ctx.new_styles.size());
+        ctx.new_style_idx[hash] = idx;
+        auto& style = ctx.new_styles.emplace_back(_stylesheet.compute_style(key, ctx.stack_keys));
+        style.hash = hash;
+        resolve_style(style, parent_font_size);
+        return idx;
+    }
+
+    idx = int(_style_table.size());
+    _style_table_idx[hash] = idx;
+    auto& style = _style_table.emplace_back(_stylesheet.query_style(key, parent_hash, ctx.stack_keys));
+    resolve_style(style, parent_font_size);
+    return idx;
+}
+
+void si::Default2DMerger::resolve_style(StyleSheet::computed_style& style, float parent_font_size) const
+{
+    style.font.size.resolve(_font->ref_size, parent_font_size);
+    CC_ASSERT(!style.border.left.has_percentage() && "not supported");
+    CC_ASSERT(!style.border.right.has_percentage() && "not supported");
+    CC_ASSERT(!style.border.top.has_percentage() && "not supported");
+    CC_ASSERT(!style.border.bottom.has_percentage() && "not supported");
+    style.border.left.resolve(0, 0);
+    style.border.right.resolve(0, 0);
+    style.border.top.resolve(0, 0);
+    style.border.bottom.resolve(0, 0);
+}
+
+si::StyleSheet::computed_style const& si::Default2DMerger::style_at(style_context const& ctx, int style_idx) const
+{
+    if (style_idx < int(_style_table.size()))
+        return _style_table[style_idx];
+
+    CC_ASSERT(ctx.is_parallel && "only parallel contexts have local styles");
+    return ctx.new_styles[style_idx - int(_style_table.size())];
+}
+
 void si::Default2DMerger::render_child_range(si::element_tree const& tree, int range_start, int range_end, tg::aabb2 const& clip)
 {
     // NOTE: visibility is checked inside build_render_data
@@ -649,7 +1682,7 @@ void si::Default2DMerger::render_child_range(si::element_tree const& tree, int r
     }
 }
 
-void si::Default2DMerger::resolve_deferred_placements(si::element_tree& tree)
+void si::Default2DMerger::resolve_deferred_placements()
 {
     // TODO: currently also computes placement for hidden elements
     //       it is not trivial to remove them though
@@ -657,15 +1690,16 @@ void si::Default2DMerger::resolve_deferred_placements(si::element_tree& tree)
     for (auto const& [placement, ref_idx, this_idx] : _deferred_placements)
     {
         // compute new pos based on placement
-        auto pbb = ref_idx < 0 ? viewport : _layout_tree[ref_idx].bounds();
-        auto cbb = _layout_tree[this_idx].bounds();
+        // NOTE: ref might be moved by a previous placement (e.g. nested popovers)
+        auto pbb = ref_idx < 0 ? viewport : get_moved_bounds(ref_idx);
+        auto cbb = get_moved_bounds(this_idx);
         auto p = placement.compute(pbb, mouse_pos, cbb);
 
         // ensure it doesn't leave the viewport
         p = tg::clamp(p, viewport.min, viewport.max - (cbb.max - cbb.min));
 
         // move sub-layout
-        move_layout(tree, this_idx, p - cbb.min);
+        move_layout(this_idx, p - cbb.min);
     }
 }
 
@@ -687,49 +1721,281 @@ int si::Default2DMerger::add_child_layout_element(int parent_idx)
     }
 }
 
-void si::Default2DMerger::move_layout(si::element_tree& tree, int layout_idx, tg::vec2 delta)
+void si::Default2DMerger::move_layout(int layout_idx, tg::vec2 delta)
 {
-    // TODO: simplify when switching to relative aabbs
     // TODO: simplify when caching text data in layouted
 
     auto& le = _layout_tree[layout_idx];
     CC_ASSERT(le.element);
     CC_ASSERT(le.child_count <= le.element->children_count);
-    le.x += delta.x;
-    le.y += delta.y;
-    le.text_origin += delta;
-    le.content_x += delta.x;
-    le.content_y += delta.y;
-    tree.set_property(*le.element, si::property::aabb, le.bounds());
+    le.pending_move += delta;
+
+    if (_pending_moves_start < 0 || layout_idx < _pending_moves_start)
+        _pending_moves_start = layout_idx;
+}
 
-    auto cs = le.child_start;
-    auto ce = le.child_start + le.child_count; // ignores detached elements as le.child_count != le.element->child_count
-    for (auto i = cs; i < ce; ++i)
-        move_layout(tree, i, delta);
+void si::Default2DMerger::apply_pending_moves(si::element_tree& tree)
+{
+    if (_pending_moves_start < 0)
+        return; // nothing moved
+
+    // NOTE: parents have smaller indices, so their pending_move is already accumulated
+    //       (and elements before the first moved one cannot be affected)
+    auto const start = _pending_moves_start;
+    _pending_moves_start = -1;
+    for (auto i = start; i < int(_layout_tree.size()); ++i)
+    {
+        auto& le = _layout_tree[i];
+        if (!le.element)
+            continue;
+
+        // detached elements ignore moves of their parent
+        if (is_in_child_range(i))
+            le.pending_move += _layout_tree[le.parent_idx].pending_move;
+
+        auto const delta = le.pending_move;
+        if (delta.x == 0 && delta.y == 0)
+            continue;
+
+        le.x += delta.x;
+        le.y += delta.y;
+        le.text_origin += delta;
+        le.content_x += delta.x;
+        le.content_y += delta.y;
+        tree.set_property(*le.element, si::property::aabb, le.bounds());
+    }
+}
+
+tg::aabb2 si::Default2DMerger::get_moved_bounds(int layout_idx) const
+{
+    auto delta = _layout_tree[layout_idx].pending_move;
+    for (auto i = layout_idx; is_in_child_range(i);)
+    {
+        i = _layout_tree[i].parent_idx;
+        delta += _layout_tree[i].pending_move;
+    }
+
+    auto bb = _layout_tree[layout_idx].bounds();
+    return {bb.min + delta, bb.max + delta};
+}
+
+bool si::Default2DMerger::is_in_child_range(int layout_idx) const
+{
+    auto const& le = _layout_tree[layout_idx];
+    if (le.is_root())
+        return false;
+
+    auto const& p = _layout_tree[le.parent_idx];
+    return layout_idx < p.child_start + p.child_count; // detached elements occupy the slots after the child range
 }
 
 void si::Default2DMerger::render_text(si::element_tree const& tree, layouted_element const& le, tg::aabb2 const& clip, size_t selection_start, size_t selection_count)
 {
-    // TODO: prebuild this in layout data
+    // NOTE: glyph quads are cached per text and font, see get_glyph_run
     auto const& e = *le.element;
     auto txt = tree.get_property(e, si::property::text);
     auto tp = le.text_origin;
+    auto const& style = style_of(le);
+    auto const& font = style.font;
+
+    if (!font.wrap)
+    {
+        add_text_render_data(_render_data.lists.back(), txt, tp.x, tp.y, font, clip, style.packed.font, style.packed.font_selected, selection_start,
+                             selection_count);
+        return;
+    }
+
+    auto const& wt = get_wrapped_text(nullptr, txt, font, le.content_width);
+    auto const lh = line_height_of(font);
+    auto const selection_end = selection_start + selection_count;
+    for (auto i = 0; i < int(wt.lines.size()); ++i)
+    {
+        auto const& l = wt.lines[i];
+        auto const line_start = size_t(l.start);
+        auto const line_end = line_start + l.count;
+
+        // selection relative to the line
+        auto sel_start = tg::max(selection_start, line_start);
+        auto sel_end = tg::min(selection_end, line_end);
+        auto sel_count = sel_end > sel_start ? sel_end - sel_start : 0;
+
+        add_text_render_data(_render_data.lists.back(), txt.subview(l.start, l.count), tp.x + line_align_offset(font.align, le.content_width, l.width), tp.y + i * lh,
+                             font, clip, style.packed.font, style.packed.font_selected, sel_start - line_start, sel_count);
+    }
+}
+
+bool si::Default2DMerger::is_occluded(tg::aabb2 const& rect) const
+{
+    for (auto i = _occluders_start; i < _occluders.size(); ++i)
+    {
+        auto const& o = _occluders[i].rect;
+        if (o.min.x <= rect.min.x && o.min.y <= rect.min.y && rect.max.x <= o.max.x && rect.max.y <= o.max.y)
+            return true;
+    }
+    return false;
+}
+
+uint64_t si::Default2DMerger::compute_render_input_hash(si::element_tree const& tree, int root_pos)
+{
+    // global inputs
+    // NOTE: root_pos is part of the hash as paint records contain the list index
+    // NOTE: glyph uvs and full_uvs depend on the font and the glyph atlas pages
+    auto h = detail::make_hash(0x524C4953, root_pos, viewport, _stylesheet.get_version(), _font_id, _glyph_atlas.eviction_count(), //
+                               instanced_quads, compact_indices, quantized_vertices);
+
+    // roots above can occlude this one
+    for (auto const& o : _occluders)
+        if (o.root_pos > root_pos)
+            h = detail::make_hash(h, o.root_pos, o.rect);
+
+    // same elements as build_render_data visits
+    // NOTE: much cheaper than building, no quads or glyphs are generated
+    auto& stack = _render_input_stack;
+    stack.clear();
+    stack.push_back(_layout_roots[root_pos]);
+    while (!stack.empty())
+    {
+        auto const& le = _layout_tree[stack.back()];
+        stack.pop_back();
+
+        detail::combine_hash(h, le.is_visible());
+        if (!le.is_visible())
+            continue;
+
+        CC_ASSERT(le.element);
+        if (le.is_in_text_edit)
+            return 0; // cursor blinks and editable text is not part of the layout
+
+        h = detail::make_hash(h, le.bounds(), le.content_x, le.content_y, le.content_width, le.text_origin, style_of(le).hash);
+        if (le.has_text)
+            detail::combine_hash(h, tree.get_property(*le.element, si::property::text));
+        h = cc::hash_xxh3(tree.get_property_or(*le.element, si::property::custom_triangles, {}).as_bytes(), h);
+
+        for (auto ci = le.child_start + le.child_count - 1; ci >= le.child_start; --ci)
+            stack.push_back(ci);
+    }
+
+    // NOTE: 0 is reserved for "not reusable"
+    return h == 0 ? 1 : h;
+}
+
+void si::Default2DMerger::update_dirty_rects()
+{
+    _dirty_rects.clear();
+
+    auto const& curr = _paint_records;
+    auto const& prev = _prev_paint_records;
+
+    auto const add_rect = [&](tg::aabb2 const& r) {
+        if (r.min.x < r.max.x && r.min.y < r.max.y)
+            _dirty_rects.push_back(r);
+    };
+
+    if (!_has_prev_paint || _prev_viewport != viewport)
+    {
+        _has_prev_paint = true;
+        _prev_viewport = viewport;
+        add_rect(viewport);
+        return;
+    }
+
+    // fast path: elements are usually painted in the same order as in the last frame
+    auto i = 0;
+    auto const common = int(tg::min(curr.size(), prev.size()));
+    for (; i < common && curr[i].id == prev[i].id; ++i)
+        if (curr[i].hash != prev[i].hash)
+        {
+            add_rect(prev[i].rect);
+            add_rect(curr[i].rect);
+        }
+
+    // remaining elements are matched by id
+    if (i < int(curr.size()) || i < int(prev.size()))
+    {
+        _prev_paint_idx.clear();
+        for (auto pi = i; pi < int(prev.size()); ++pi)
+            _prev_paint_idx[prev[pi].id] = pi;
+
+        _prev_paint_matched.clear();
+        _prev_paint_matched.resize(prev.size(), false);
+
+        for (auto ci = i; ci < int(curr.size()); ++ci)
+        {
+            int pi;
+            if (_prev_paint_idx.get_to(curr[ci].id, pi) && !_prev_paint_matched[pi])
+            {
+                _prev_paint_matched[pi] = true;
+                if (curr[ci].hash == prev[pi].hash)
+                    continue;
+                add_rect(prev[pi].rect);
+            }
+            add_rect(curr[ci].rect);
+        }
 
-    add_text_render_data(_render_data.lists.back(), txt, tp.x, tp.y, le.style.font, clip, selection_start, selection_count);
+        // removed elements
+        for (auto pi = i; pi < int(prev.size()); ++pi)
+            if (!_prev_paint_matched[pi])
+                add_rect(prev[pi].rect);
+    }
+
+    if (_dirty_rects.empty())
+        return;
+
+    // merge overlapping rects
+    // NOTE: many small rects are collapsed into one (viewers cannot benefit from them anyway)
+    auto const max_rects = 64;
+    if (_dirty_rects.size() > max_rects * 4)
+    {
+        auto u = _dirty_rects[0];
+        for (auto const& r : _dirty_rects)
+            u = {min(u.min, r.min), max(u.max, r.max)};
+        _dirty_rects.clear();
+        _dirty_rects.push_back(u);
+    }
+
+    auto merged = true;
+    while (merged)
+    {
+        merged = false;
+        for (auto a = 0; a < int(_dirty_rects.size()); ++a)
+            for (auto b = int(_dirty_rects.size()) - 1; b > a; --b)
+            {
+                auto& ra = _dirty_rects[a];
+                auto const& rb = _dirty_rects[b];
+                if (ra.max.x <= rb.min.x || rb.max.x <= ra.min.x || ra.max.y <= rb.min.y || rb.max.y <= ra.min.y)
+                    continue; // disjoint
+
+                ra = {min(ra.min, rb.min), max(ra.max, rb.max)};
+                _dirty_rects[b] = _dirty_rects.back();
+                _dirty_rects.pop_back();
+                merged = true;
+            }
+    }
+
+    if (_dirty_rects.size() > max_rects)
+    {
+        auto u = _dirty_rects[0];
+        for (auto const& r : _dirty_rects)
+            u = {min(u.min, r.min), max(u.max, r.max)};
+        _dirty_rects.clear();
+        _dirty_rects.push_back(u);
+    }
 }
 
 void si::Default2DMerger::build_render_data(si::element_tree const& tree, layouted_element const& le, tg::aabb2 clip)
 {
-    if (le.style.visibility != style::visibility::visible)
+    if (!le.is_visible())
         return; // hidden element
 
+    auto const& style = style_of(le);
+
     CC_ASSERT(le.element);
     auto bb = le.bounds();
     auto bb_clip = intersection(bb, clip);
     if (!bb_clip.has_value())
         return; // early out: out of clip
 
-    if (le.style.overflow == style::overflow::hidden)
+    if (style.overflow == style::overflow::hidden)
         clip = bb_clip.value();
 
     tg::aabb2 text_cursor_bb;
@@ -737,11 +2003,25 @@ void si::Default2DMerger::build_render_data(si::element_tree const& tree, layout
     size_t text_sel_start = 0;
     size_t text_sel_count = 0;
 
+    auto const tris = tree.get_property_or(*le.element, si::property::custom_triangles, {});
+
+    // occlusion culling
+    // NOTE: only the element itself is skipped, children might extend beyond it (unless clipped)
+    // NOTE: text, text edit, and custom triangles might also extend beyond the element
+    if (is_occluded(bb_clip.value()) && tris.empty() && !le.is_in_text_edit
+        && (!le.has_text || style.font.wrap || is_occluded(le.text_bounds())))
+    {
+        ++_stats_occluded_elements;
+        if (style.overflow != style::overflow::hidden)
+            render_child_range(tree, le.child_start, le.child_start + le.child_count, clip);
+        return;
+    }
+
     // generic draw cmds
     {
         auto& rl = _render_data.lists.back();
 
-        auto const& border = le.style.border;
+        auto const& border = style.border;
         auto border_left = border.left.get();
         auto border_right = border.right.get();
         auto border_top = border.top.get();
@@ -749,32 +2029,46 @@ void si::Default2DMerger::build_render_data(si::element_tree const& tree, layout
 
         // border (up to 4 quads)
         if (border_left > 0)
-            add_quad(rl, {bb.min, {bb.min.x + border_left, bb.max.y}}, border.color, clip);
+            add_quad(rl, {bb.min, {bb.min.x + border_left, bb.max.y}}, style.packed.border, clip);
         if (border_right > 0)
-            add_quad(rl, {{bb.max.x - border_right, bb.min.y}, bb.max}, border.color, clip);
+            add_quad(rl, {{bb.max.x - border_right, bb.min.y}, bb.max}, style.packed.border, clip);
         if (border_top > 0)
-            add_quad(rl, {{bb.min.x + border_left, bb.min.y}, {bb.max.x - border_right, bb.min.y + border_top}}, border.color, clip);
+            add_quad(rl, {{bb.min.x + border_left, bb.min.y}, {bb.max.x - border_right, bb.min.y + border_top}}, style.packed.border, clip);
         if (border_bottom > 0)
-            add_quad(rl, {{bb.min.x + border_left, bb.max.y - border_bottom}, {bb.max.x - border_right, bb.max.y}}, border.color, clip);
+            add_quad(rl, {{bb.min.x + border_left, bb.max.y - border_bottom}, {bb.max.x - border_right, bb.max.y}}, style.packed.border, clip);
 
         // background
-        if (le.style.bg.color.a > 0)
+        if (style.bg.color.a > 0)
         {
             auto bbg = bb;
             bbg.min.x += border_left;
             bbg.max.x -= border_right;
             bbg.min.y += border_top;
             bbg.max.y -= border_bottom;
-            add_quad(rl, bbg, le.style.bg.color, clip);
+            add_quad(rl, bbg, style.packed.bg, clip);
         }
 
         // custom triangles
-        auto tris = tree.get_property_or(*le.element, si::property::custom_triangles, {});
-        for (auto const& v : tris)
+        // NOTE: with 16 bit indices, large meshes are split (at whole triangles) so that each chunk fits into a cmd
+        auto const max_tri_vertices = rl.use_indices16 ? render_list::max_indices16_vertices / 3 * 3 : tris.size();
+        for (size_t chunk_start = 0; chunk_start < tris.size(); chunk_start += max_tri_vertices)
         {
-            rl.indices.push_back(int(rl.vertices.size()));
-            rl.vertices.push_back({v.pos + tg::vec2(le.content_x, le.content_y), {0, 0}, to_rgba8(v.color)});
-            rl.cmds.back().indices_count++;
+            auto const chunk_size = tg::min(max_tri_vertices, tris.size() - chunk_start);
+            auto const chunk = tris.subspan(chunk_start, chunk_size);
+
+            auto& cmd = rl.current_cmd(false, clip, chunk_size);
+            auto const uv = rl.full_uv_of(cmd.texture_handle);
+            auto const vi = rl.vertices.size();
+            rl.vertices.resize(vi + chunk_size);
+            for (size_t i = 0; i < chunk_size; ++i)
+            {
+                rl.add_index(vi + i);
+                rl.vertices[vi + i].pos = chunk[i].pos + tg::vec2(le.content_x, le.content_y);
+                rl.vertices[vi + i].uv = uv;
+            }
+            // NOTE: colors are converted in a batch
+            detail::to_rgba8(&chunk[0].color, sizeof(chunk[0]), chunk_size, &rl.vertices[vi].color, sizeof(vertex));
+            cmd.indices_count += uint32_t(chunk_size);
         }
 
         // text edit selection and cursor
@@ -782,7 +2076,10 @@ void si::Default2DMerger::build_render_data(si::element_tree const& tree, layout
         {
             auto const cursor_rad = 1;
 
-            // TODO: multi line support
+            // TODO: style sheet?
+            auto const sc = style.packed.selection;
+
+            // selection is rendered per line
             auto smin = tg::pos2(tg::max<float>());
             auto smax = tg::pos2(tg::min<float>());
             auto any_sel = false;
@@ -802,6 +2099,13 @@ void si::Default2DMerger::build_render_data(si::element_tree const& tree, layout
                 if (g.start >= _editable_text.selection_start() + _editable_text.selection_count())
                     continue;
 
+                if (any_sel && g.bounds.min.y != smin.y) // next line
+                {
+                    add_quad(rl, {smin, smax}, sc, clip);
+                    smin = tg::pos2(tg::max<float>());
+                    smax = tg::pos2(tg::min<float>());
+                }
+
                 smin = min(smin, g.bounds.min);
                 smax = max(smax, g.bounds.max);
                 any_sel = true;
@@ -812,7 +2116,7 @@ void si::Default2DMerger::build_render_data(si::element_tree const& tree, layout
                 if (_editable_text.glyphs().empty()) // not text at all
                 {
                     text_cursor_bb.min = bb.min - tg::vec2(cursor_rad, 0);
-                    text_cursor_bb.max = bb.min + tg::vec2(cursor_rad, _font.baseline_height * le.style.font.size.absolute / _font.ref_size);
+                    text_cursor_bb.max = bb.min + tg::vec2(cursor_rad, line_height_of(style.font));
                 }
                 else // after last text
                 {
@@ -822,14 +2126,8 @@ void si::Default2DMerger::build_render_data(si::element_tree const& tree, layout
                 }
             }
 
-            if (any_sel) // render selection
-            {
-                // TODO: style sheet?
-                auto fc = le.style.font.color;
-                auto avg = (fc.r + fc.g + fc.b) / 3;
-                auto sc = avg > 0.5 ? tg::color3::white : tg::color3::black;
+            if (any_sel) // render selection (of the last line)
                 add_quad(rl, {smin, smax}, sc, clip);
-            }
 
             // NOTE: cursor is rendered _after_ text
             render_text_cursor = int(total_time * 2) % 2 == 0;
@@ -845,7 +2143,43 @@ void si::Default2DMerger::build_render_data(si::element_tree const& tree, layout
 
     // text cursor
     if (render_text_cursor)
-        add_quad(_render_data.lists.back(), text_cursor_bb, le.style.font.color, clip);
+        add_quad(_render_data.lists.back(), text_cursor_bb, style.packed.font, clip);
+
+    // paint record (for dirty rects)
+    {
+        auto rect = bb_clip.value();
+        auto h = detail::make_hash(0x5041494E, rect, style.hash, uint64_t(_render_data.lists.size()), le.is_in_text_edit);
+        h = cc::hash_xxh3(tris.as_bytes(), h);
+        for (auto const& v : tris)
+        {
+            auto const p = tg::clamp(v.pos + tg::vec2(le.content_x, le.content_y), clip.min, clip.max);
+            rect = {min(rect.min, p), max(rect.max, p)};
+        }
+
+        if (tree.has_property(*le.element, si::property::text))
+        {
+            auto txt = tree.get_property(*le.element, si::property::text);
+            detail::combine_hash(h, txt);
+            detail::combine_hash(h, le.text_origin);
+            detail::combine_hash(h, _font_id); // same text, different glyphs
+
+            // NOTE: unwrapped text can overflow its element
+            // NOTE: uses the measured size from the style pass instead of re-measuring the glyphs
+            if (!style.font.wrap)
+                if (auto tb = intersection(le.text_bounds(), clip); tb.has_value())
+                    rect = {min(rect.min, tb.value().min), max(rect.max, tb.value().max)};
+        }
+
+        if (le.is_in_text_edit)
+        {
+            // NOTE: includes the blinking of the cursor
+            h = detail::make_hash(h, text_sel_start, text_sel_count, render_text_cursor, text_cursor_bb);
+            if (auto cb = intersection(text_cursor_bb, clip); cb.has_value())
+                rect = {min(rect.min, cb.value().min), max(rect.max, cb.value().max)};
+        }
+
+        _paint_records.push_back({le.element->id.id(), rect, h});
+    }
 
     // children
     render_child_range(tree, le.child_start, le.child_start + le.child_count, clip);
@@ -1,16 +1,19 @@
 #include "Default2DMerger.hh"
 
+#include <fstream>
+
 #include <clean-core/base64.hh>
 
-void si::Default2DMerger::load_default_font()
+namespace
+{
+void decode_default_font(si::Default2DMerger::font_atlas& f)
 {
-    auto& f = _font;
     f.ref_size = 20.0;
     f.ascender = 19;
     f.baseline_height = 24;
     f.width = 1113;
     f.height = 21;
-    f.full_uv = {0, 0};
+    f.full_uv = {1.f / f.width, 1.f / f.height}; // NOTE: the texels at (0,0) to (1,1) are white
     f.data = cc::base64_decode(
         "//8AAAA5//8vAAD0/2ts//MAAAAAAEv/lAAA4/kDAAAAAAAAAEJ4AAAAAAAAAAAAAAAAAAAAMgUAAAAAAAyH3fnllhUAAAAAADD//y4AAAAAAAAksxcAABezJAAAAAAAAAAAAAL7+wIA"
         "AAAAAAAAAP/0AAAAAAAAQ+PlRwAAdby8vLy8vHUAAETj4UEAAAAAAAAAAAAAABIAAAAAAAA5vPLyuzkAAAAAAAAAJMH/2AAAAAAAADWq6PnhkxQAAAAAAAA/run65KIoAAAAAAAAAABm"
@@ -331,4 +334,49 @@ void si::Default2DMerger::load_default_font()
     f.glyphs['|'] = {{{0.9739442946990117, 0}, {0.977538185085355, 0.9047619047619048}}, 4, 17, 4, 19, 12.0};
     f.glyphs['}'] = {{{0.9793351302785265, 0}, {0.9865229110512129, 0.9523809523809523}}, 2, 17, 8, 20, 12.0};
     f.glyphs['~'] = {{{0.9883198562443846, 0}, {0.9991015274034142, 0.19047619047619047}}, 0, 8, 12, 4, 12.0};
+
+    for (auto c = 0; c < 128; ++c)
+        f.ascii_glyphs[c] = uint8_t(c < ' ' || c >= int(f.glyphs.size()) ? '?' : c);
+}
+}
+
+void si::Default2DMerger::load_default_font()
+{
+    // NOTE: decoded on first use, then shared by all mergers (never modified afterwards)
+    static auto const default_font = [] {
+        auto f = std::make_shared<font_atlas>();
+        decode_default_font(*f);
+        return std::shared_ptr<font_atlas const>(cc::move(f));
+    }();
+
+    _font = default_font;
+}
+
+bool si::Default2DMerger::load_font(cc::vector<std::byte> ttf)
+{
+    if (!_glyph_atlas.load_ttf(cc::move(ttf)))
+        return false;
+
+    // re-keys all text caches
+    ++_font_id;
+    _text_metrics.clear();
+    _glyph_runs.clear();
+    _text_words.clear();
+    _wrapped_texts.clear();
+    return true;
+}
+
+bool si::Default2DMerger::load_font_file(cc::string_view path)
+{
+    std::ifstream file(cc::string(path).c_str(), std::ios::binary | std::ios::ate);
+    if (!file.good())
+        return false;
+
+    auto ttf = cc::vector<std::byte>::uninitialized(size_t(file.tellg()));
+    file.seekg(0);
+    file.read(reinterpret_cast<char*>(ttf.data()), std::streamsize(ttf.size()));
+    if (!file.good())
+        return false;
+
+    return load_font(cc::move(ttf));
 }
@@ -1,7 +1,12 @@
 #pragma once
 
 #include <cstdint>
+#include <memory> // shared_ptr
 
+#include <clean-core/array.hh>
+#include <clean-core/map.hh>
+#include <clean-core/pair.hh>
+#include <clean-core/span.hh>
 #include <clean-core/string.hh>
 #include <clean-core/string_view.hh>
 #include <clean-core/vector.hh>
@@ -9,10 +14,13 @@
 #include <typed-geometry/tg-lean.hh>
 
 #include <structured-interface/anchor.hh>
+#include <structured-interface/detail/frame_cache.hh>
+#include <structured-interface/detail/worker_pool.hh>
 #include <structured-interface/fwd.hh>
 #include <structured-interface/handles.hh>
 #include <structured-interface/merger/StyleSheet.hh>
 #include <structured-interface/merger/editable_text.hh>
+#include <structured-interface/merger/glyph_atlas.hh>
 #include <structured-interface/style.hh>
 
 namespace si
@@ -44,6 +52,21 @@ public:
     tg::aabb2 viewport = {{0, 0}, {1920, 1080}};
     double total_time = 0;
 
+    /// if true, top-level roots (e.g. windows) are styled concurrently on a worker pool
+    /// NOTE: produces the same results as the serial path
+    bool parallel_style = false;
+    /// if true, top-level roots (e.g. windows) are layouted concurrently on a worker pool
+    /// NOTE: deferred placements are still resolved serially afterwards
+    bool parallel_layout = false;
+    /// if true, quads are emitted as quad_instances instead of vertices and indices (see render_list)
+    bool instanced_quads = false;
+    /// if true, render lists use 16 bit indices (render_list::indices16), cmds are split every 65536 vertices
+    bool compact_indices = false;
+    /// if true, render lists additionally contain quantized vertices (render_list::compact_vertices)
+    bool quantized_vertices = false;
+    /// if true, no render data is emitted for elements that are fully covered by opaque roots (e.g. windows) above them
+    bool occlusion_culling = true;
+
     // input test!
 public:
     tg::pos2 mouse_pos;
@@ -56,6 +79,13 @@ private:
     bool was_lmb_down = false;
     float drag_distance = 0;
 
+    // hover result of the last query
+    // NOTE: is reused if neither the mouse nor the layout (see _layout_generation) changed
+    tg::pos2 _hover_cache_pos;
+    int _hover_cache_generation = -1;
+    element_handle _hover_cache_direct;
+    cc::vector<element_handle> _hover_cache_stack;
+
     // styling
 public:
     StyleSheet& style_sheet() { return _stylesheet; }
@@ -94,9 +124,28 @@ public:
 
         // currently only suitable for ASCII
         cc::vector<glyph_info> glyphs;
+        cc::array<uint8_t, 128> ascii_glyphs; ///< codepoint -> index into glyphs ('?' if not supported)
+
+        glyph_info const& glyph_of(char32_t codepoint) const { return glyphs[codepoint < 128 ? ascii_glyphs[codepoint] : '?']; }
     };
 
-    font_atlas const& get_font_atlas() const { return _font; }
+    /// NOTE: the default font atlas is shared by all mergers and immutable
+    font_atlas const& get_font_atlas() const { return *_font; }
+
+    /// replaces the baked default font by glyphs that are rasterized on demand from a .ttf
+    /// returns false if the font cannot be loaded (the previous font stays active)
+    /// NOTE: text quads then reference glyph atlas pages via glyph_page_texture
+    /// NOTE: the glyph atlas must be configured before (e.g. get_glyph_atlas().sdf = true)
+    bool load_font(cc::vector<std::byte> ttf);
+    bool load_font_file(cc::string_view path);
+
+    /// renderers must upload the dirty rects of the pages and clear them afterwards
+    merger::glyph_atlas& get_glyph_atlas() { return _glyph_atlas; }
+    bool uses_glyph_atlas() const { return _glyph_atlas.is_loaded(); }
+
+    /// texture_handle of draw_cmds using the given glyph atlas page
+    /// NOTE: texture_handle 0 is the font_atlas
+    static constexpr uint64_t glyph_page_texture(int page) { return uint64_t(page) + 1; }
 
     // render data
     // (inspired by imgui)
@@ -107,17 +156,133 @@ public:
         tg::pos2 uv;  // in pixels?
         uint32_t color = 0xFFFFFFFF;
     };
+    /// a quantized vertex (12 instead of 20 bytes)
+    struct compact_vertex
+    {
+        int16_t x = 0;  // in 1/compact_pos_scale pixels
+        int16_t y = 0;
+        uint16_t u = 0; // in 1/65535
+        uint16_t v = 0;
+        uint32_t color = 0xFFFFFFFF;
+    };
+    static constexpr float compact_pos_scale = 4.f;
+    /// an axis-aligned quad for instanced drawing
+    struct quad_instance
+    {
+        tg::aabb2 rect; // in pixels
+        tg::aabb2 uv;
+        uint32_t color = 0xFFFFFFFF;
+        uint32_t clip_idx = 0; // into render_list::clip_rects (same as the clip_rect of its cmd)
+    };
+    /// NOTE: a cmd either draws indexed triangles (indices_count > 0) or instanced quads (instances_count > 0)
+    /// NOTE: geometry is not clipped, renderers must use clip_rect as scissor rect
     struct draw_cmd
     {
         uint64_t texture_handle = 0;
+        tg::aabb2 clip_rect; // in pixels
         uint32_t indices_start = 0;
         uint32_t indices_count = 0;
+        uint32_t instances_start = 0;
+        uint32_t instances_count = 0;
+        uint32_t vertex_offset = 0; // added to all indices (only non-zero for 16 bit indices)
+        uint32_t reserved = 0;      // NOTE: explicit padding (content hashes include all bytes)
     };
+    /**
+     * Draw data of one layer
+     *
+     * In the default mode, everything is drawn as indexed triangles.
+     * With use_instances (see Default2DMerger::instanced_quads), all quads are emitted as quad_instances instead
+     * and only custom triangles use vertices and indices.
+     * With use_indices16 (see Default2DMerger::compact_indices), indices16 is used instead of indices
+     * and cmds must be drawn with draw_cmd::vertex_offset as base vertex.
+     * With use_compact_vertices, compact_vertices contains a quantized copy of vertices.
+     * Cmds must be drawn in order.
+     * A new cmd is only started if the texture, the clip rect, or the primitive kind changes.
+     *
+     * There is one list per layout root (e.g. window, tooltip, popover), in back-to-front order.
+     * If is_changed is false, the list with the same id in the previous frame had the same use_* modes
+     * and the same vertices, compact_vertices, indices, indices16, instances, clip_rects, and cmds
+     * (so renderers can keep all uploaded buffers).
+     * This holds both for lists that were rebuilt (compared via content_hash)
+     * and for lists that were taken over unchanged (see compute_render_input_hash).
+     * NOTE: glyph atlas pages and the font atlas are not covered (see glyph_atlas::dirty_rects).
+     */
     struct render_list
     {
+        uint64_t id = 0;           ///< element id of the layout root
+        uint64_t content_hash = 0; ///< hash of the use_* modes and all buffers (see compute_content_hash)
+        bool is_changed = true;
+
         cc::vector<vertex> vertices;
         cc::vector<int> indices;
+        cc::vector<uint16_t> indices16; // relative to draw_cmd::vertex_offset
+        cc::vector<compact_vertex> compact_vertices;
+        cc::vector<quad_instance> instances;
+        cc::vector<tg::aabb2> clip_rects;
         cc::vector<draw_cmd> cmds;
+
+        bool use_instances = false;
+        bool use_indices16 = false;
+        bool use_compact_vertices = false;
+
+        /// uvs of an opaque white texel, for untextured quads (which are drawn with whatever texture the cmd has)
+        tg::pos2 font_atlas_full_uv;  ///< for texture_handle 0
+        tg::pos2 glyph_page_full_uv; ///< for glyph atlas pages
+        tg::pos2 full_uv_of(uint64_t texture_handle) const { return texture_handle == 0 ? font_atlas_full_uv : glyph_page_full_uv; }
+
+        /// max vertices per cmd with 16 bit indices
+        static constexpr size_t max_indices16_vertices = 65536;
+
+        /// removes all content but keeps the memory
+        void clear()
+        {
+            vertices.clear();
+            indices.clear();
+            indices16.clear();
+            compact_vertices.clear();
+            instances.clear();
+            clip_rects.clear();
+            cmds.clear();
+        }
+
+        size_t index_count() const { return use_indices16 ? indices16.size() : indices.size(); }
+
+        /// appends count quads and returns their 4 * count vertices for filling (reserve-then-fill)
+        /// vertex order per quad is (min.x, min.y), (max.x, min.y), (min.x, max.y), (max.x, max.y)
+        /// NOTE: indices are already written, but are not added to any draw_cmd
+        /// NOTE: the pointer is only valid until the next append
+        /// NOTE: current_cmd must be called before (with at least 4 * count vertices)
+        vertex* add_quads(size_t count);
+
+        /// appends an index (relative to the vertex_offset of the last cmd for 16 bit indices)
+        void add_index(size_t vertex_idx)
+        {
+            if (use_indices16)
+                indices16.push_back(uint16_t(vertex_idx - cmds.back().vertex_offset));
+            else
+                indices.push_back(int(vertex_idx));
+        }
+
+        /// same as add_quads for instanced quads
+        quad_instance* add_quad_instances(size_t count);
+
+        /// index of the clip rect in clip_rects (reuses the last one if equal)
+        uint32_t clip_index_of(tg::aabb2 const& clip);
+
+        /// returns the cmd that new triangles or instances with the given clip are added to (adds a new one if needed)
+        /// new_vertices is the number of vertices that will be added (for splitting cmds with 16 bit indices)
+        /// NOTE: a new cmd keeps the texture of the previous one
+        draw_cmd& current_cmd(bool instanced, tg::aabb2 const& clip, size_t new_vertices = 0);
+
+        /// adds a new cmd starting at the current end
+        draw_cmd& add_cmd(uint64_t texture_handle, tg::aabb2 const& clip);
+
+        /// fills compact_vertices from vertices
+        void quantize_vertices();
+
+        /// hashes use_instances, use_indices16, use_compact_vertices, vertices, compact_vertices,
+        /// indices, indices16, instances, clip_rects, and cmds
+        uint64_t compute_content_hash() const;
     };
     struct render_data
     {
@@ -126,6 +291,11 @@ public:
 
     render_data const& get_render_data() const { return _render_data; }
 
+    /// screen regions whose pixels changed in the last merge (e.g. for partial redraws)
+    /// NOTE: empty if nothing changed, contains the whole viewport in the first frame or if the viewport changed
+    /// NOTE: rects do not overlap
+    cc::span<tg::aabb2 const> get_dirty_rects() const { return _dirty_rects; }
+
 public:
     /// performs the merge operation (called in gui::update)
     element_tree operator()(element_tree const&, element_tree&& new_ui, input_state& input);
@@ -139,56 +309,122 @@ public:
     /// used in stats::ui for displaying time for user recording
     void set_record_timings(double seconds) { _seconds_record = seconds; }
 
+    /// collects all input-receiving elements whose (visible) bounds intersect the rect (e.g. for drag-select)
+    /// result is in back-to-front order
+    /// NOTE: refers to the layout of the last merge
+    void query_input_elements_in(tg::aabb2 const& rect, cc::vector<element_handle>& out);
+
     // private helper
 private:
     void load_default_font();
 
     void emit_warning(element_handle id, cc::string_view msg);
 
-    void set_editable_text_glyphs(cc::string_view txt, float x, float y, style::font const& font);
+    void set_editable_text_glyphs(cc::string_view txt, float x, float y, style::font const& font, float wrap_width = -1.f); // NOTE: no wrapping if wrap_width < 0
     tg::aabb2 get_text_bounds(cc::string_view txt, float x, float y, style::font const& font);
-    void add_text_render_data(render_list& rl, cc::string_view txt, float x, float y, style::font const& font, tg::aabb2 const& clip, size_t selection_start, size_t selection_count);
+    void add_text_render_data(render_list& rl,
+                              cc::string_view txt,
+                              float x,
+                              float y,
+                              style::font const& font,
+                              tg::aabb2 const& clip,
+                              uint32_t color, // NOTE: packed
+                              uint32_t selected_color,
+                              size_t selection_start,
+                              size_t selection_count);
 
     // styling
 private:
+    struct style_context;
+
+    /// assigns initial positions and z-order (window_idx) of all windows in the tree
+    /// NOTE: is done before styling so that computing styles does not modify the tree
+    void prepare_windows(si::element_tree& tree);
+    /// helper for prepare_windows (handles the windows among the given siblings)
+    void prepare_sibling_windows(si::element_tree& tree, cc::span<si::element_tree_element> elements);
+
+    /// entry point for styling: allocates the layout tree and computes style of all roots
+    /// (each root gets a fixed layout slot range, so serial and parallel styling produce the same tree)
+    void compute_root_style(si::element_tree& tree, cc::span<element_handle> hover_stack);
+
     /// entry point for allocating layouted_element and computing style of a single element
-    void compute_style(si::element_tree& tree,
+    void compute_style(style_context& ctx,
+                       si::element_tree& tree,
                        si::element_tree_element& e,
                        int layout_idx,
                        int parent_layout_idx,
-                       StyleSheet::computed_style const& parent_style,
+                       int parent_style_idx,
                        int child_idx,
                        int child_cnt,
                        cc::span<element_handle> hover_stack);
     /// recursive helper for computing style of children
-    void compute_child_style(si::element_tree& tree,
+    void compute_child_style(style_context& ctx,
+                             si::element_tree& tree,
                              int parent_layout_idx,
                              cc::span<si::element_tree_element> elements,
-                             StyleSheet::computed_style const& style,
+                             int style_idx,
                              cc::span<element_handle> hover_stack);
 
+    /// returns the index of the resolved style for the given key in _style_table
+    /// (queries and resolves the style if not interned yet)
+    /// NOTE: in parallel contexts, new styles are stored in the context until merged
+    int query_style_idx(style_context& ctx, StyleSheet::style_key key, int parent_style_idx);
+
+    /// resolves style values that only depend on the parent (e.g. relative font sizes)
+    void resolve_style(StyleSheet::computed_style& style, float parent_font_size) const;
+
+    /// same as style_of but also sees the not-yet-merged styles of the context
+    StyleSheet::computed_style const& style_at(style_context const& ctx, int style_idx) const;
+
+    StyleSheet::computed_style const& style_of(layouted_element const& le) const { return _style_table[le.style_idx]; }
+
     // layouting
 private:
     /// new algo for resolving layouting
     void resolve_layout_new(si::element_tree& tree);
 
+    /// computes subtree hashes and marks subtrees whose layout can be taken from the last frame
+    /// (sizes are preloaded, positions are translated during layouting)
+    void prepare_layout_reuse(si::element_tree const& tree);
+    /// stores the final layout of this frame in _layout_slots (for reuse in the next frame)
+    /// increments _layout_generation if anything relevant for hit testing changed
+    /// NOTE: must be called after all layout changes (including deferred placements)
+    void store_layout_slots();
+
     /// helper for adding a child to the layout tree
     int add_child_layout_element(int parent_idx);
 
     /// moves a layout element (and all children) to a given position
     /// afterwards, bounds.min += delta
-    void move_layout(si::element_tree& tree, int layout_idx, tg::vec2 delta);
+    /// NOTE: is O(1), the actual positions are only updated in apply_pending_moves
+    void move_layout(int layout_idx, tg::vec2 delta);
+
+    /// applies all pending moves (in a single top-down pass) and updates the aabb of moved elements
+    /// NOTE: only walks the layout tree if move_layout was called (starting at the first moved element)
+    void apply_pending_moves(si::element_tree& tree);
+
+    /// bounds of a layout element including moves that are not applied yet
+    tg::aabb2 get_moved_bounds(int layout_idx) const;
+
+    /// true if the element is part of its parent's child range
+    /// (i.e. not a root and not detached, so it follows the parent's moves)
+    bool is_in_child_range(int layout_idx) const;
 
     /// returns the topmost input-receiving element at the given position
     /// returns nullptr if nothing hit
-    /// (uses _layout_tree)
-    si::element_tree_element* query_input_element_at(tg::pos2 p) const;
-    /// implementation helper for query_input_element_at
-    si::element_tree_element* query_input_child_element_at(int layout_idx, tg::pos2 p) const;
+    /// (uses _hit_grid)
+    si::element_tree_element* query_input_element_at(tg::pos2 p);
     /// same as query_input_element_at but returns a layouted_element
     /// and can also return any element, not only input receiving ones
-    layouted_element const* query_layout_element_at(tg::pos2 p) const;
-    layouted_element const* query_child_layout_element_at(int layout_idx, tg::pos2 p) const;
+    layouted_element const* query_layout_element_at(tg::pos2 p);
+    /// implementation helper for the queries above, returns the _hit_grid entry or -1
+    int query_hit_entry_at(tg::pos2 p, bool input_only);
+
+    /// returns the layouted element of a tree element (or nullptr if not layouted)
+    layouted_element const* get_layout_element_of(si::element_tree const& tree, si::element_tree_element const& e) const;
+
+    /// builds _hit_grid from the current _layout_tree (if not valid yet)
+    void update_hit_grid();
 
     // render methods
     // note: clip is already clipped to element aabb
@@ -202,12 +438,177 @@ private:
     // NOTE: end is exclusive
     void render_child_range(si::element_tree const& tree, int range_start, int range_end, tg::aabb2 const& clip);
 
+    /// compares _paint_records with the last frame and fills _dirty_rects
+    void update_dirty_rects();
+
+    /// true if rect is fully covered by an opaque root above the current one
+    bool is_occluded(tg::aabb2 const& rect) const;
+
+    /// hash of everything build_render_data reads for the root at _layout_roots[root_pos]
+    /// returns 0 if the root cannot be reused (e.g. text edit with a blinking cursor)
+    uint64_t compute_render_input_hash(si::element_tree const& tree, int root_pos);
+
     // private member
 private:
-    font_atlas _font;
+    std::shared_ptr<font_atlas const> _font;
+    int _font_id = 0; ///< distinguishes fonts in text caches
     render_data _render_data;
+    cc::vector<render_list> _prev_render_lists; ///< lists of the last frame, matched by id to keep their memory
+    cc::map<uint64_t, int> _prev_render_list_idx; ///< id -> index in _prev_render_lists
+
+    /// per render list: what is needed to reuse it when its root did not change
+    struct render_list_state
+    {
+        uint64_t input_hash = 0; ///< see compute_render_input_hash
+        bool is_reused = false;  ///< taken over from the last frame without building
+        int paint_start = 0;     ///< range of its records in _paint_records
+        int paint_count = 0;
+        int occluded_elements = 0;
+    };
+    cc::vector<render_list_state> _render_list_states;      ///< parallel to _render_data.lists
+    cc::vector<render_list_state> _prev_render_list_states; ///< parallel to _prev_render_lists
+    cc::vector<int> _render_input_stack;                    ///< for compute_render_input_hash
+    int _stats_render_lists_reused = 0;
+
+    // occlusion culling
+private:
+    struct occluder
+    {
+        int root_pos = 0; ///< index in _layout_roots
+        tg::aabb2 rect;   ///< opaque region
+    };
+
+    cc::vector<occluder> _occluders; ///< sorted by root_pos
+    size_t _occluders_start = 0;     ///< first occluder above the root that is currently rendered
+    int _stats_occluded_elements = 0;
+
+    // dirty rects
+private:
+    /// what was painted for an element (recorded in build_render_data)
+    struct paint_record
+    {
+        uint64_t id = 0;
+        tg::aabb2 rect;    ///< covered screen region
+        uint64_t hash = 0; ///< everything that affects the pixels (incl. rect)
+    };
+
+    cc::vector<paint_record> _paint_records;
+    cc::vector<paint_record> _prev_paint_records;
+    cc::map<uint64_t, int> _prev_paint_idx; ///< id -> index in _prev_paint_records (only built if the element order changed)
+    cc::vector<bool> _prev_paint_matched;
+    cc::vector<tg::aabb2> _dirty_rects;
+    tg::aabb2 _prev_viewport;
+    bool _has_prev_paint = false;
     StyleSheet _stylesheet;
 
+    // text caches
+private:
+    struct text_metrics
+    {
+        float width = 0;
+        float height = 0;
+    };
+
+    /// height of a text line
+    float line_height_of(style::font const& font) const;
+
+    /// key for all text caches: text content, font size, and font
+    uint64_t text_key(cc::string_view txt, style::font const& font) const;
+
+    /// size of the text bounds, cached in _text_metrics
+    /// NOTE: in parallel styling, the cache is only read and new entries are merged afterwards
+    text_metrics measure_text(style_context& ctx, cc::string_view txt, style::font const& font);
+
+    /// pre-built glyph quads of a text, relative to the text origin and scaled to the font size
+    struct glyph_run
+    {
+        struct quad
+        {
+            tg::aabb2 bounds;
+            tg::aabb2 uv;
+            int char_idx = 0; ///< index into the text (for selections)
+            int page = -1;    ///< glyph atlas page, -1 for the font_atlas
+        };
+
+        cc::vector<quad> quads;   ///< only visible glyphs
+        cc::vector<float> char_x; ///< start x of each byte plus the end x (trailing bytes of multi-byte chars are at the char end)
+        float height = 0;
+    };
+
+    /// a line of wrapped text
+    struct text_line
+    {
+        int start = 0; ///< byte range in the text
+        int count = 0;
+        float width = 0;
+    };
+
+    /// a text broken into lines at a maximum width
+    struct wrapped_text
+    {
+        cc::vector<text_line> lines;
+        float width = 0; ///< of the widest line
+        float height = 0;
+    };
+
+    /// break opportunities of a text
+    /// NOTE: independent of the width, so re-wrapping at a new width is a single pass over the words
+    struct text_words
+    {
+        struct word
+        {
+            int start = 0;
+            int end = 0;      ///< exclusive, without trailing spaces
+            float x_start = 0; ///< in single-line coordinates
+            float x_end = 0;
+            bool is_line_end = false; ///< followed by a '\n'
+        };
+
+        cc::vector<word> words;
+    };
+
+    /// cache entries that were used or created during parallel layouting (merged afterwards)
+    struct text_cache_updates
+    {
+        cc::vector<uint64_t> touched_keys;
+        cc::vector<cc::pair<uint64_t, text_words>> new_words;
+        cc::vector<cc::pair<uint64_t, wrapped_text>> new_wrapped;
+
+        void clear()
+        {
+            touched_keys.clear();
+            new_words.clear();
+            new_wrapped.clear();
+        }
+    };
+
+    /// kerning + advance of a char (prev is updated to the char)
+    float char_advance(merger::glyph_atlas::codepoint_metrics& prev, char32_t codepoint, style::font const& font) const;
+
+    text_words compute_text_words(cc::string_view txt, style::font const& font) const;
+    wrapped_text compute_wrapped_text(text_words const& words, style::font const& font, float max_width) const;
+
+    /// lines of the text wrapped at max_width, cached in _wrapped_texts (and _text_words)
+    /// NOTE: if updates is set, the caches are only read and new entries are collected in updates
+    /// NOTE: the reference is only valid until the next call
+    wrapped_text const& get_wrapped_text(text_cache_updates* updates, cc::string_view txt, style::font const& font, float max_width);
+    void merge_text_cache_updates(text_cache_updates& updates);
+
+    /// glyph quads of the text, cached in _glyph_runs
+    /// NOTE: the reference is only valid until the next call
+    glyph_run const& get_glyph_run(cc::string_view txt, style::font const& font);
+
+    detail::frame_cache<text_metrics> _text_metrics;
+    detail::frame_cache<glyph_run> _glyph_runs;
+    int _glyph_runs_evictions = 0; ///< eviction count of the glyph atlas the runs refer to
+    glyph_run _tmp_glyph_run;     ///< for runs that could not be fully rasterized (not cached)
+
+    merger::glyph_atlas _glyph_atlas;
+
+    detail::frame_cache<text_words> _text_words;
+    detail::frame_cache<wrapped_text> _wrapped_texts;
+    cc::vector<text_cache_updates> _layout_text_updates; ///< per root job in parallel layouting
+
     // tmp external data
 private:
     si::element_tree const* _prev_ui = nullptr;
@@ -226,11 +627,22 @@ private:
 
     // layout tree
 private:
-    // special value for unassigned layout values
+    // special value for layout values that are not computed yet
     static constexpr float unassigned = tg::max<float>();
-    // special value for layout values that are currently getting computed
-    // used to detect cycles
-    static constexpr float computing = -tg::max<float>();
+
+    /**
+     * the part of the computed style that can be overwritten per element (e.g. via properties)
+     * everything else is shared between all elements with the same style hash
+     */
+    struct style_override
+    {
+        style::value left;
+        style::value top;
+        style::value width;
+        style::value height;
+        style::visibility visibility = style::visibility::visible;
+        style::positioning positioning = style::positioning::normal;
+    };
 
     /**
      * a layouted element is part of a derived UI tree
@@ -244,6 +656,8 @@ private:
      *  - contains some duplicated properties for faster access
      *  - has NOT the same indices as element_tree elements
      *
+     * NOTE: the style is shared via _style_table, only per-element values are stored here
+     *
      * TODO: if layout becomes a bottleneck, splitting this into multiple structs might help cache locality
      */
     struct layouted_element
@@ -263,32 +677,125 @@ private:
         float text_width = 0.f;
         float text_height = 0.f;
         tg::aabb2 bounds() const { return {{x, y}, {x + width, y + height}}; }
-        StyleSheet::computed_style style;
+        int style_idx = -1; // in _style_table
+        style_override local_style;
         // TODO: total_bounds that can be larger for when children move out of inner bounds (e.g. menus)
         // TODO: total_bounds not needed because menus are separate, detached things
         // TODO: text layout cache (like cached glyphs)
         // TODO: local coords, mat2 transformation, polar coords
         tg::pos2 text_origin;
+        tg::aabb2 text_bounds() const { return {text_origin, text_origin + tg::vec2(text_width, text_height)}; } // NOTE: requires text_origin
+        tg::vec2 pending_move; // accumulated move_layout delta for this element and its children (see apply_pending_moves)
         int child_start = 0;
         int child_count = 0;
         bool no_input = false;        // ignores input
         bool is_in_text_edit = false; // for showing the cursor and selection
         bool has_text = false;
+        bool is_text_wrapped = false; // text_width/height are of the wrapped text (see font.wrap)
+        bool uses_parent_size = false; // size depends on the parent (or viewport)
+        bool is_layout_reused = false; // sizes are taken from the last frame
 
         bool has_prev_normal_sibling() const { return prev_normal_idx != -1; }
-        bool is_left_right_layout() const { return style.layout == style::layout::left_right; }
-        bool is_top_down_layout() const { return style.layout == style::layout::top_down; }
         bool is_root() const { return parent_idx == -1; }
-        bool is_normal() const { return style.positioning == style::positioning::normal; }
-        bool is_absolute() const { return style.positioning == style::positioning::absolute; }
+        bool is_visible() const { return local_style.visibility == style::visibility::visible; }
+        bool is_normal() const { return local_style.positioning == style::positioning::normal; }
+        bool is_absolute() const { return local_style.positioning == style::positioning::absolute; }
     };
 
+    /// all distinct resolved styles
+    /// (layouted_element::style_idx points into this, _style_table[0] is the root style)
+    /// NOTE: persists across frames until the style sheet changes, so indices are stable
+    cc::vector<StyleSheet::computed_style> _style_table;
+    cc::map<StyleSheet::style_hash, int> _style_table_idx;
+    int _style_table_version = -1; ///< StyleSheet::get_version() of the styles in _style_table
+
+    /**
+     * style inputs and result per layout slot
+     * used to skip style queries for elements whose key and parent style did not change since the last frame
+     *
+     * NOTE: layout slots are allocated deterministically, so an unchanged UI hits the same slots again
+     */
+    struct style_slot
+    {
+        StyleSheet::style_key key = element_type::none;
+        int parent_style_idx = -1; // in _style_table
+        int style_idx = -1;        // in _style_table
+
+        bool has_same_input(style_slot const& rhs) const
+        {
+            return parent_style_idx == rhs.parent_style_idx
+                   && cc::bit_cast<StyleSheet::style_key_int_t>(key) == cc::bit_cast<StyleSheet::style_key_int_t>(rhs.key);
+        }
+    };
+    cc::vector<style_slot> _style_slots;      ///< per _layout_tree slot of the current frame
+    cc::vector<style_slot> _prev_style_slots; ///< per _layout_tree slot of the last frame
+
     // TODO: maybe make roots sortable for different layers (e.g. tooltips > popovers)
 
     cc::vector<layouted_element> _layout_tree;
     cc::vector<int> _layout_roots;          // points into layout_tree (contains detached roots after style computation)
     cc::vector<int> _layout_detached_roots; // points into layout_tree
     int _layout_original_roots = 0;
+    cc::vector<int> _element_layout_idx; // per element of the merged tree, -1 if not layouted
+
+    /**
+     * uniform grid over the bounds of all layouted elements for hit testing
+     *
+     * NOTE:
+     *  - entries are in back-to-front order (same as a recursive search from the last root)
+     *    so the last hit in a cell is the topmost one
+     *  - entry bounds are clipped by all parents (children only receive hits inside their parents)
+     *  - built lazily on the first query after layouting
+     */
+    struct hit_entry
+    {
+        tg::aabb2 bounds;
+        int layout_idx = -1;
+        bool is_input = false; // visible, consumes input and not inside a no_input subtree
+    };
+    struct hit_grid
+    {
+        tg::aabb2 bounds;
+        int cells_x = 0;
+        int cells_y = 0;
+        tg::vec2 inv_cell_size;
+        cc::vector<hit_entry> entries;
+        cc::vector<int> cell_start;   // per cell (+1) offset into cell_entries
+        cc::vector<int> cell_entries; // entry indices, ascending per cell
+        bool is_valid = false;
+    };
+    hit_grid _hit_grid;
+    cc::vector<int> _tmp_hit_indices;
+
+    /**
+     * layout inputs and results per layout slot
+     * used to skip layouting of subtrees whose inputs did not change since the last frame
+     *
+     * NOTE: positions are stored relative to the parent so that reused subtrees can follow a moved parent
+     */
+    struct layout_slot
+    {
+        uint64_t subtree_hash = 0; // all layout inputs of the element and its children (but not its parent)
+        float rel_x = 0.f;         // x - parent x (or x for roots)
+        float rel_y = 0.f;         // y - parent y (or y for roots)
+        float content_dx = 0.f;    // content_x - x
+        float content_dy = 0.f;    // content_y - y
+        float width = 0.f;
+        float height = 0.f;
+        float content_width = 0.f;
+        float content_height = 0.f;
+        float text_width = 0.f;  // wrapped extent for wrapped text
+        float text_height = 0.f;
+        bool uses_parent_size = false;
+
+        // for hit testing
+        tg::aabb2 bounds;
+        element_handle id;
+        bool no_input = false;
+    };
+    cc::vector<layout_slot> _layout_slots;      ///< per _layout_tree slot of the current frame
+    cc::vector<layout_slot> _prev_layout_slots; ///< per _layout_tree slot of the last frame
+    int _layout_generation = 0;                 ///< changes whenever bounds, ids or input flags of the layout change
 
 
     /**
@@ -301,9 +808,10 @@ private:
         int layout_idx_this;
     };
     cc::vector<deferred_placement> _deferred_placements;
+    int _pending_moves_start = -1; ///< smallest layout idx with a pending move (-1 if none, see move_layout)
 
     /// e.g. detached elements can have placement constraints that require accurate resolution
-    void resolve_deferred_placements(si::element_tree& tree);
+    void resolve_deferred_placements();
 
     // temp helper
 private:
@@ -316,7 +824,63 @@ private:
     };
     cc::vector<window_index> _tmp_windows; ///< for sorting them
 
-    cc::vector<StyleSheet::style_key> _style_stack_keys;
+    /**
+     * state for computing styles of a range of layout slots
+     * the serial path uses a single context for all roots,
+     * the parallel path uses one context per root and merges them in root order afterwards
+     */
+    struct style_context
+    {
+        int next_layout_idx = 0; ///< next free slot in _layout_tree
+        int end_layout_idx = 0;  ///< end of the slot range of this context
+
+        cc::vector<StyleSheet::style_key> stack_keys;
+        cc::vector<window_index> tmp_windows; ///< used as stack as nested windows are styled recursively
+        cc::vector<int> detached_roots;
+        cc::vector<deferred_placement> deferred_placements;
+        int styles_reused = 0;
+
+        // parallel only: text metrics that were used or computed (merged into _text_metrics afterwards)
+        cc::vector<uint64_t> touched_text_keys;
+        cc::vector<cc::pair<uint64_t, text_metrics>> new_text_metrics;
+
+        // parallel only: styles that are not in _style_table yet
+        // (their indices start at _style_table.size() and are remapped when merging)
+        bool is_parallel = false;
+        cc::vector<StyleSheet::computed_style> new_styles;
+        cc::map<StyleSheet::style_hash, int> new_style_idx;
+        cc::vector<int> new_style_remap;
+
+        void reset(bool parallel)
+        {
+            stack_keys.clear();
+            tmp_windows.clear();
+            detached_roots.clear();
+            deferred_placements.clear();
+            styles_reused = 0;
+            is_parallel = parallel;
+            new_styles.clear();
+            new_style_idx.clear();
+            touched_text_keys.clear();
+            new_text_metrics.clear();
+        }
+    };
+
+    /// a root element with its pre-computed layout slot range
+    struct style_root_job
+    {
+        si::element_tree_element* element = nullptr;
+        int layout_idx = -1;
+        int child_idx = 0;
+        int child_cnt = 0;
+        int slot_start = 0;
+        int slot_end = 0;
+    };
+
+    cc::vector<style_context> _style_contexts; ///< [0] is used for serial styling
+    cc::vector<style_root_job> _style_root_jobs;
+
+    cc::unique_ptr<detail::worker_pool> _workers; ///< created on first use (shared by styling and layouting)
 
     // stats
 private:
@@ -325,5 +889,7 @@ private:
     double _seconds_layout = 0;
     double _seconds_input = 0;
     double _seconds_render_data = 0;
+    int _stats_styles_reused = 0;
+    int _stats_layouts_reused = 0;
 };
 }
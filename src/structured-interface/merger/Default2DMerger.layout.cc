@@ -1,5 +1,11 @@
 #include "Default2DMerger.hh"
 
+#include <limits>
+#include <utility> // swap
+
+#include <clean-core/function_ref.hh>
+
+#include <structured-interface/detail/hash.hh>
 #include <structured-interface/element_tree.hh>
 #include <structured-interface/properties.hh>
 
@@ -12,8 +18,9 @@
 namespace
 {
 // on_rel is either the relative value it references OR a function to compute it
+// NOTE: does not write back into v as styles are shared between elements
 template <class AutoF, class RelF>
-float resolve(si::style::value& v, AutoF&& on_auto, RelF&& on_rel)
+float resolve(si::style::value const& v, AutoF&& on_auto, RelF&& on_rel)
 {
     if (v.is_resolved())
         return v.absolute;
@@ -21,15 +28,9 @@ float resolve(si::style::value& v, AutoF&& on_auto, RelF&& on_rel)
     if (v.is_auto())
     {
         if constexpr (std::is_arithmetic_v<std::remove_reference_t<AutoF>>)
-        {
-            v = float(on_auto);
-            return v.absolute;
-        }
+            return float(on_auto);
         else
-        {
-            v = float(on_auto());
-            return v.absolute;
-        }
+            return float(on_auto());
     }
 
     CC_ASSERT(v.has_percentage()); // otherwise would have been resolved
@@ -40,24 +41,57 @@ float resolve(si::style::value& v, AutoF&& on_auto, RelF&& on_rel)
     else
         rel_ref = float(on_rel());
 
-    v.absolute += rel_ref * v.relative;
-    v.relative = 0;
-    return v.absolute;
+    return v.absolute + rel_ref * v.relative;
+}
+
+void hash_value(uint64_t& h, si::style::value const& v)
+{
+    si::detail::combine_hash(h, v.type);
+    si::detail::combine_hash(h, v.absolute);
+    si::detail::combine_hash(h, v.relative);
 }
 }
 
 void si::Default2DMerger::resolve_layout_new(si::element_tree& tree)
 {
+    /*
+     * layouting is done in two passes over _layout_tree (no recursion):
+     *
+     * 1. measure (bottom-up, reverse index order)
+     *    computes all sizes that only depend on the element itself and its children
+     *    (children always have larger indices than their parent, so they are measured first)
+     *
+     * 2. place (top-down, index order)
+     *    parents and previous siblings are already placed
+     *    computes positions and all sizes that depend on the parent (e.g. percentages, stretching)
+     *
+     * values that are not known yet are "unassigned"
+     * if a value still cannot be computed in the place pass, the layout is cyclic
+     * (e.g. a percentage-sized child inside an auto-sized parent)
+     *
+     * with parallel_layout, both passes run concurrently per root subtree (see compute_root_style for the slot ranges)
+     * only the roots themselves are placed serially because normal roots are stacked below each other
+     * everything that writes into the tree is done serially afterwards
+     */
+
     struct layouter_t
     {
         si::element_tree& tree;
         Default2DMerger& merger;
 
+        /// set if a computation read a value that is not known yet
+        bool is_missing = false;
+
+        /// set in parallel layouting (text caches are then only read)
+        text_cache_updates* text_updates = nullptr;
+
         layouter_t(si::element_tree& t, Default2DMerger& m) : tree(t), merger(m) {}
 
         // helper
     public:
-        bool is_valid(float v) const { return v != computing && v != unassigned && tg::is_finite(v); }
+        static bool is_valid(float v) { return v != unassigned && tg::is_finite(v); }
+
+        StyleSheet::computed_style const& style_of(layouted_element const& e) const { return merger.style_of(e); }
 
         layouted_element& parent_of(layouted_element& e)
         {
@@ -65,6 +99,30 @@ void si::Default2DMerger::resolve_layout_new(si::element_tree& tree)
             return merger._layout_tree[e.parent_idx];
         }
 
+        /// reads a layout value that might not be known yet
+        float value_of(float v)
+        {
+            if (v == unassigned)
+            {
+                is_missing = true;
+                return 0.f;
+            }
+            return v;
+        }
+
+        /// returns true if the computation succeeded and assigns the value
+        bool try_assign(float& v, cc::function_ref<float()> f)
+        {
+            is_missing = false;
+            auto r = f();
+            if (is_missing)
+                return false;
+
+            v = r;
+            CC_ASSERT(is_valid(v));
+            return true;
+        }
+
         float reference_parent_x(layouted_element& e)
         {
             if (e.is_root())
@@ -72,16 +130,16 @@ void si::Default2DMerger::resolve_layout_new(si::element_tree& tree)
 
             auto& p = parent_of(e);
 
-            switch (p.style.box_child_ref)
+            switch (style_of(p).box_child_ref)
             {
             case style::box_type::content_box:
-                return compute_content_x(p);
+                return value_of(p.content_x);
 
             case style::box_type::padding_box:
-                return compute_x(p) + p.style.border.left.get();
+                return value_of(p.x) + style_of(p).border.left.get();
 
             case style::box_type::border_box:
-                return compute_x(p);
+                return value_of(p.x);
             }
 
             CC_UNREACHABLE("invalid box type");
@@ -94,16 +152,16 @@ void si::Default2DMerger::resolve_layout_new(si::element_tree& tree)
 
             auto& p = parent_of(e);
 
-            switch (p.style.box_child_ref)
+            switch (style_of(p).box_child_ref)
             {
             case style::box_type::content_box:
-                return compute_content_y(p);
+                return value_of(p.content_y);
 
             case style::box_type::padding_box:
-                return compute_y(p) + p.style.border.top.get();
+                return value_of(p.y) + style_of(p).border.top.get();
 
             case style::box_type::border_box:
-                return compute_y(p);
+                return value_of(p.y);
             }
 
             CC_UNREACHABLE("invalid box type");
@@ -116,8 +174,8 @@ void si::Default2DMerger::resolve_layout_new(si::element_tree& tree)
 
             auto& p = parent_of(e);
 
-            auto x = compute_content_x(p);
-            if (p.style.layout == style::layout::left_right)
+            auto x = value_of(p.content_x);
+            if (style_of(p).layout == style::layout::left_right)
                 x += p.text_width; // padding after text?
             return x;
         }
@@ -129,29 +187,31 @@ void si::Default2DMerger::resolve_layout_new(si::element_tree& tree)
 
             auto& p = parent_of(e);
 
-            auto y = compute_content_y(p);
-            if (p.style.layout == style::layout::top_down)
+            auto y = value_of(p.content_y);
+            if (style_of(p).layout == style::layout::top_down)
                 y += p.text_height; // padding after text?
             return y;
         }
 
         float reference_parent_width(layouted_element& e)
         {
+            e.uses_parent_size = true;
+
             if (e.is_root())
                 return merger.viewport.max.x - merger.viewport.min.x;
 
             auto& p = parent_of(e);
 
-            switch (e.style.box_child_ref)
+            switch (style_of(e).box_child_ref)
             {
             case style::box_type::content_box:
-                return compute_content_width(p);
+                return value_of(p.content_width);
 
             case style::box_type::padding_box:
-                return compute_width(p) - p.style.border.left.get() - p.style.border.right.get();
+                return value_of(p.width) - style_of(p).border.left.get() - style_of(p).border.right.get();
 
             case style::box_type::border_box:
-                return compute_width(p);
+                return value_of(p.width);
             }
 
             CC_UNREACHABLE("invalid box type");
@@ -159,428 +219,467 @@ void si::Default2DMerger::resolve_layout_new(si::element_tree& tree)
 
         float reference_parent_height(layouted_element& e)
         {
+            e.uses_parent_size = true;
+
             if (e.is_root())
                 return merger.viewport.max.y - merger.viewport.min.y;
 
             auto& p = parent_of(e);
 
-            switch (e.style.box_child_ref)
+            switch (style_of(e).box_child_ref)
             {
             case style::box_type::content_box:
-                return compute_content_height(p);
+                return value_of(p.content_height);
 
             case style::box_type::padding_box:
-                return compute_height(p) - p.style.border.top.get() - p.style.border.bottom.get();
+                return value_of(p.height) - style_of(p).border.top.get() - style_of(p).border.bottom.get();
 
             case style::box_type::border_box:
-                return compute_height(p);
+                return value_of(p.height);
             }
 
             CC_UNREACHABLE("invalid box type");
         }
 
-        bool is_parent_left_right(layouted_element& e) { return !e.is_root() && parent_of(e).is_left_right_layout(); }
-        bool is_parent_top_down(layouted_element& e) { return e.is_root() || parent_of(e).is_top_down_layout(); }
+        bool is_parent_left_right(layouted_element& e) { return !e.is_root() && style_of(parent_of(e)).layout == style::layout::left_right; }
+        bool is_parent_top_down(layouted_element& e) { return e.is_root() || style_of(parent_of(e)).layout == style::layout::top_down; }
 
-        float get_right(layouted_element& e) { return compute_x(e) + compute_width(e); }
-        float get_bottom(layouted_element& e) { return compute_y(e) + compute_height(e); }
-        float get_content_right(layouted_element& e) { return compute_content_x(e) + compute_content_width(e); }
+        bool is_stretched_x(layouted_element const& e) const
+        {
+            return e.is_absolute() && e.local_style.width.is_auto() && !e.local_style.left.is_auto() && !style_of(e).bounds.right.is_auto();
+        }
+        bool is_stretched_y(layouted_element const& e) const
+        {
+            return e.is_absolute() && e.local_style.height.is_auto() && !e.local_style.top.is_auto() && !style_of(e).bounds.bottom.is_auto();
+        }
+
+        float get_right(layouted_element& e) { return value_of(e.x) + value_of(e.width); }
+        float get_bottom(layouted_element& e) { return value_of(e.y) + value_of(e.height); }
+        float get_content_right(layouted_element& e) { return e.content_x + e.content_width; }
 
         float get_left_margin(layouted_element& e)
         {
-            return resolve(e.style.margin.left, 0.f, [&] { return reference_parent_width(e); });
+            return resolve(style_of(e).margin.left, 0.f, [&] { return reference_parent_width(e); });
         }
         float get_right_margin(layouted_element& e)
         {
-            return resolve(e.style.margin.right, 0.f, [&] { return reference_parent_width(e); });
+            return resolve(style_of(e).margin.right, 0.f, [&] { return reference_parent_width(e); });
         }
         float get_top_margin(layouted_element& e)
         {
-            return resolve(e.style.margin.top, 0.f, [&] { return reference_parent_height(e); });
+            return resolve(style_of(e).margin.top, 0.f, [&] { return reference_parent_height(e); });
         }
         float get_bottom_margin(layouted_element& e)
         {
-            return resolve(e.style.margin.bottom, 0.f, [&] { return reference_parent_height(e); });
+            return resolve(style_of(e).margin.bottom, 0.f, [&] { return reference_parent_height(e); });
         }
 
-        // main layout computations
+        // sizes
+        // NOTE: content sizes from children are computed relative to the element,
+        //       i.e. as if the element was placed at the origin
     public:
-        float compute_x(layouted_element& e)
+        float content_width_from_children(layouted_element& e)
         {
-            CC_ASSERT(e.x != computing && "cyclic layout detected");
-            if (e.x != unassigned)
-                return e.x;
-            e.x = computing;
+            auto const cs = e.child_start;
+            auto const ce = e.child_start + e.child_count;
 
-            if (e.is_absolute())
-            {
-                auto is_left_auto = e.style.bounds.left.is_auto();
-                auto is_right_auto = e.style.bounds.right.is_auto();
-                auto is_width_auto = e.style.bounds.width.is_auto();
+            // NOTE: wrapped text that is not wrapped yet only breaks at '\n' (i.e. auto width is the widest explicit line)
+            auto const text_width = is_wrapped_text(e) && !e.is_text_wrapped ? unwrapped_text_width(e) : e.text_width;
 
-                if (is_left_auto && is_right_auto && !is_width_auto)
-                {
-                    CC_ASSERT(false && "TODO: centering");
-                }
-                else if (!is_left_auto) // left aligned
-                {
-                    auto margin_left = resolve(e.style.margin.left, 0.f, [&] { return reference_parent_width(e); });
-                    auto left = resolve(e.style.bounds.left, 0.f, [&] { return reference_parent_width(e); });
-                    e.x = reference_parent_x(e) + margin_left + left;
-                }
-                else // right aligned
-                {
-                    auto margin_right = resolve(e.style.margin.right, 0.f, [&] { return reference_parent_width(e); });
-                    auto right = resolve(e.style.bounds.right, 0.f, [&] { return reference_parent_width(e); });
-                    e.x = reference_parent_x(e) + reference_parent_width(e) - margin_right - right - compute_width(e);
-                }
-            }
-            else if (e.has_prev_normal_sibling() && is_parent_left_right(e)) // left-right layout with prev sibling
-            {
-                auto margin_left = resolve(e.style.margin.left, 0.f, [&] { return reference_parent_width(e); });
-                auto& sibling = merger._layout_tree[e.prev_normal_idx];
-                e.x = get_right(sibling) + tg::max(margin_left, get_right_margin(sibling));
-            }
-            else
+            float w = text_width;
+            switch (style_of(e).layout)
             {
-                auto margin_left = resolve(e.style.margin.left, 0.f, [&] { return reference_parent_width(e); });
-                e.x = reference_parent_content_x_with_text(e) + margin_left;
-            }
-
-            CC_ASSERT(is_valid(e.x));
-            return e.x;
-        }
-
-        float compute_y(layouted_element& e)
-        {
-            CC_ASSERT(e.y != computing && "cyclic layout detected");
-            if (e.y != unassigned)
-                return e.y;
-            e.y = computing;
-
-            if (e.is_absolute())
+            case style::layout::left_right:
             {
-                auto is_top_auto = e.style.bounds.top.is_auto();
-                auto is_bottom_auto = e.style.bounds.bottom.is_auto();
-                auto is_height_auto = e.style.bounds.height.is_auto();
+                // same chain of normal children as in place_x
+                auto x_start = style_of(e).border.left.get() + resolve(style_of(e).padding.left, 0.f, [&] { return reference_parent_width(e); });
+                x_start += text_width;
 
-                if (is_top_auto && is_bottom_auto && !is_height_auto)
+                auto last_normal = -1;
+                auto right = 0.f;
+                for (auto i = cs; i < ce; ++i)
                 {
-                    CC_ASSERT(false && "TODO: centering");
-                }
-                else if (!is_top_auto) // top aligned
-                {
-                    auto margin_top = resolve(e.style.margin.top, 0.f, [&] { return reference_parent_height(e); });
-                    auto top = resolve(e.style.bounds.top, 0.f, [&] { return reference_parent_height(e); });
-                    e.y = reference_parent_y(e) + margin_top + top;
-                }
-                else // bottom aligned
-                {
-                    auto margin_bottom = resolve(e.style.margin.bottom, 0.f, [&] { return reference_parent_height(e); });
-                    auto bottom = resolve(e.style.bounds.bottom, 0.f, [&] { return reference_parent_height(e); });
-                    e.y = reference_parent_y(e) + reference_parent_height(e) - margin_bottom - bottom - compute_height(e);
+                    auto& c = merger._layout_tree[i];
+                    if (!c.is_normal())
+                        continue;
+
+                    auto margin_left = get_left_margin(c);
+                    auto x = last_normal == -1 ? x_start + margin_left
+                                               : right + tg::max(margin_left, get_right_margin(merger._layout_tree[last_normal]));
+                    right = x + value_of(c.width);
+                    last_normal = i;
                 }
+                if (last_normal != -1)
+                    w = right + get_right_margin(merger._layout_tree[last_normal]);
             }
-            else if (e.has_prev_normal_sibling() && is_parent_top_down(e)) // top-down layout with prev sibling
+            break;
+            case style::layout::top_down:
             {
-                auto margin_top = resolve(e.style.margin.top, 0.f, [&] { return reference_parent_height(e); });
-                auto& sibling = merger._layout_tree[e.prev_normal_idx];
-                e.y = get_bottom(sibling) + tg::max(margin_top, get_bottom_margin(sibling));
+                for (auto i = cs; i < ce; ++i)
+                {
+                    auto& c = merger._layout_tree[i];
+                    if (c.is_normal())
+                        w = tg::max(w, value_of(c.width) + get_left_margin(c) + get_right_margin(c));
+                }
             }
-            else
-            {
-                auto margin_top = resolve(e.style.margin.top, 0.f, [&] { return reference_parent_height(e); });
-                e.y = reference_parent_content_y_with_text(e) + margin_top;
+            break;
             }
 
-            CC_ASSERT(is_valid(e.y));
-            return e.y;
+            return w;
         }
 
-        float compute_width(layouted_element& e)
+        float content_height_from_children(layouted_element& e)
         {
-            CC_ASSERT(e.width != computing && "cyclic layout detected");
-            if (e.width != unassigned)
-                return e.width;
-            e.width = computing;
+            // height of wrapped text is only known once the width is
+            if (is_wrapped_text(e) && !e.is_text_wrapped)
+                return value_of(unassigned);
 
-            float w = 0.f;
+            auto const cs = e.child_start;
+            auto const ce = e.child_start + e.child_count;
 
-            // stretched
-            if (e.is_absolute() && e.style.bounds.width.is_auto() && !e.style.bounds.left.is_auto() && !e.style.bounds.right.is_auto())
+            float h = e.text_height;
+            switch (style_of(e).layout)
             {
-                auto x = compute_x(e);
-
-                auto margin_right = resolve(e.style.margin.right, 0.f, [&] { return reference_parent_width(e); });
-                auto right = resolve(e.style.bounds.right, 0.f, [&] { return reference_parent_width(e); });
-                auto max_x = reference_parent_x(e) + reference_parent_width(e) - margin_right - right;
-
-                w = max_x - x;
-            }
-            else if (e.style.box_sizing == style::box_type::content_box || e.style.bounds.width.is_auto()) // from content
+            case style::layout::left_right:
             {
-                w = compute_content_width(e);
-                w += e.style.border.left.get();
-                w += e.style.border.right.get();
-                w += resolve(e.style.padding.left, 0.f, [&] { return reference_parent_width(e); });
-                w += resolve(e.style.padding.right, 0.f, [&] { return reference_parent_width(e); });
+                for (auto i = cs; i < ce; ++i)
+                {
+                    auto& c = merger._layout_tree[i];
+                    if (c.is_normal())
+                        h = tg::max(h, value_of(c.height) + get_top_margin(c) + get_bottom_margin(c));
+                }
             }
-            else // from parent
+            break;
+            case style::layout::top_down:
             {
-                w = resolve(e.style.bounds.width, 0.f, [&] { return reference_parent_width(e); });
+                // same chain of normal children as in place_y
+                auto y_start = style_of(e).border.top.get() + resolve(style_of(e).padding.top, 0.f, [&] { return reference_parent_height(e); });
+                y_start += e.text_height;
 
-                if (e.style.box_sizing == style::box_type::padding_box)
+                auto last_normal = -1;
+                auto bottom = 0.f;
+                for (auto i = cs; i < ce; ++i)
                 {
-                    w += e.style.border.left.get();
-                    w += e.style.border.right.get();
+                    auto& c = merger._layout_tree[i];
+                    if (!c.is_normal())
+                        continue;
+
+                    auto margin_top = get_top_margin(c);
+                    auto y = last_normal == -1 ? y_start + margin_top
+                                               : bottom + tg::max(margin_top, get_bottom_margin(merger._layout_tree[last_normal]));
+                    bottom = y + value_of(c.height);
+                    last_normal = i;
                 }
+                if (last_normal != -1)
+                    h = bottom + get_bottom_margin(merger._layout_tree[last_normal]);
+            }
+            break;
             }
-            e.width = w;
 
-            CC_ASSERT(is_valid(e.width));
-            return e.width;
+            return h;
         }
 
-        float compute_height(layouted_element& e)
+        /// computes width and content_width as far as possible
+        void try_compute_width(layouted_element& e)
         {
-            CC_ASSERT(e.height != computing && "cyclic layout detected");
-            if (e.height != unassigned)
-                return e.height;
-            e.height = computing;
-
-            float h = 0.f;
+            auto const& s = style_of(e);
+            auto const& ls = e.local_style;
 
-            // stretched
-            if (e.is_absolute() && e.style.bounds.height.is_auto() && !e.style.bounds.top.is_auto() && !e.style.bounds.bottom.is_auto())
+            if (ls.width.is_auto() || s.box_sizing == style::box_type::content_box) // content first
             {
-                auto y = compute_y(e);
-
-                auto margin_bottom = resolve(e.style.margin.bottom, 0.f, [&] { return reference_parent_height(e); });
-                auto bottom = resolve(e.style.bounds.bottom, 0.f, [&] { return reference_parent_height(e); });
-                auto max_y = reference_parent_y(e) + reference_parent_height(e) - margin_bottom - bottom;
-
-                h = max_y - y;
+                if (e.content_width == unassigned)
+                    try_assign(e.content_width, [&] {
+                        if (ls.width.is_auto()) // from children
+                            return content_width_from_children(e);
+                        else // from parent
+                            return resolve(ls.width, 0.f, [&] { return reference_parent_width(e); });
+                    });
+
+                // NOTE: stretched width is computed in place_x
+                if (e.width == unassigned && e.content_width != unassigned && !is_stretched_x(e))
+                    try_assign(e.width, [&] {
+                        auto w = e.content_width;
+                        w += s.border.left.get();
+                        w += s.border.right.get();
+                        w += resolve(s.padding.left, 0.f, [&] { return reference_parent_width(e); });
+                        w += resolve(s.padding.right, 0.f, [&] { return reference_parent_width(e); });
+                        return w;
+                    });
             }
-            else if (e.style.box_sizing == style::box_type::content_box || e.style.bounds.height.is_auto()) // from content
+            else // width first
             {
-                h = compute_content_height(e);
-                h += e.style.border.top.get();
-                h += e.style.border.bottom.get();
-                h += resolve(e.style.padding.top, 0.f, [&] { return reference_parent_height(e); });
-                h += resolve(e.style.padding.bottom, 0.f, [&] { return reference_parent_height(e); });
+                if (e.width == unassigned)
+                    try_assign(e.width, [&] {
+                        auto w = resolve(ls.width, 0.f, [&] { return reference_parent_width(e); });
+                        if (s.box_sizing == style::box_type::padding_box)
+                        {
+                            w += s.border.left.get();
+                            w += s.border.right.get();
+                        }
+                        return w;
+                    });
+
+                if (e.content_width == unassigned && e.width != unassigned)
+                    try_assign(e.content_width, [&] {
+                        auto w = e.width;
+                        w -= resolve(s.padding.left, 0.f, [&] { return reference_parent_width(e); });
+                        w -= resolve(s.padding.right, 0.f, [&] { return reference_parent_width(e); });
+                        if (s.box_sizing == style::box_type::border_box)
+                        {
+                            w -= s.border.left.get();
+                            w -= s.border.right.get();
+                        }
+                        return w;
+                    });
             }
-            else // from parent
-            {
-                h = resolve(e.style.bounds.height, 0.f, [&] { return reference_parent_height(e); });
+        }
 
-                if (e.style.box_sizing == style::box_type::padding_box)
-                {
-                    h += e.style.border.top.get();
-                    h += e.style.border.bottom.get();
-                }
-            }
-            e.height = h;
+        bool is_wrapped_text(layouted_element const& e) const { return e.has_text && style_of(e).font.wrap; }
 
-            CC_ASSERT(is_valid(e.height));
-            return e.height;
+        /// width of the text when only breaking lines at '\n'
+        float unwrapped_text_width(layouted_element const& e)
+        {
+            auto txt = tree.get_property(*e.element, si::property::text);
+            return merger.get_wrapped_text(text_updates, txt, style_of(e).font, std::numeric_limits<float>::max()).width;
         }
 
-        float compute_content_x(layouted_element& e)
+        /// replaces the single-line text size by the wrapped one
+        void wrap_text(layouted_element& e)
         {
-            CC_ASSERT(e.content_x != computing && "cyclic layout detected");
-            if (e.content_x != unassigned)
-                return e.content_x;
-            e.content_x = computing;
-
-            e.content_x = compute_x(e) +              //
-                          e.style.border.left.get() + //
-                          resolve(e.style.padding.left, 0.f, [&] { return reference_parent_width(e); });
-
-            CC_ASSERT(is_valid(e.content_x));
-            return e.content_x;
+            auto txt = tree.get_property(*e.element, si::property::text);
+            auto const& wt = merger.get_wrapped_text(text_updates, txt, style_of(e).font, e.content_width);
+            e.text_width = wt.width;
+            e.text_height = wt.height;
+            e.is_text_wrapped = true;
         }
 
-        float compute_content_y(layouted_element& e)
+        /// computes height and content_height as far as possible
+        void try_compute_height(layouted_element& e)
         {
-            CC_ASSERT(e.content_y != computing && "cyclic layout detected");
-            if (e.content_y != unassigned)
-                return e.content_y;
-            e.content_y = computing;
+            auto const& s = style_of(e);
+            auto const& ls = e.local_style;
 
-            e.content_y = compute_y(e) +             //
-                          e.style.border.top.get() + //
-                          resolve(e.style.padding.top, 0.f, [&] { return reference_parent_height(e); });
+            if (is_wrapped_text(e) && !e.is_text_wrapped && e.content_width != unassigned)
+                wrap_text(e);
 
-            CC_ASSERT(is_valid(e.content_y));
-            return e.content_y;
+            if (ls.height.is_auto() || s.box_sizing == style::box_type::content_box) // content first
+            {
+                if (e.content_height == unassigned)
+                    try_assign(e.content_height, [&] {
+                        if (ls.height.is_auto()) // from children
+                            return content_height_from_children(e);
+                        else // from parent
+                            return resolve(ls.height, 0.f, [&] { return reference_parent_height(e); });
+                    });
+
+                // NOTE: stretched height is computed in place_y
+                if (e.height == unassigned && e.content_height != unassigned && !is_stretched_y(e))
+                    try_assign(e.height, [&] {
+                        auto h = e.content_height;
+                        h += s.border.top.get();
+                        h += s.border.bottom.get();
+                        h += resolve(s.padding.top, 0.f, [&] { return reference_parent_height(e); });
+                        h += resolve(s.padding.bottom, 0.f, [&] { return reference_parent_height(e); });
+                        return h;
+                    });
+            }
+            else // height first
+            {
+                if (e.height == unassigned)
+                    try_assign(e.height, [&] {
+                        auto h = resolve(ls.height, 0.f, [&] { return reference_parent_height(e); });
+                        if (s.box_sizing == style::box_type::padding_box)
+                        {
+                            h += s.border.top.get();
+                            h += s.border.bottom.get();
+                        }
+                        return h;
+                    });
+
+                if (e.content_height == unassigned && e.height != unassigned)
+                    try_assign(e.content_height, [&] {
+                        auto h = e.height;
+                        h -= resolve(s.padding.top, 0.f, [&] { return reference_parent_height(e); });
+                        h -= resolve(s.padding.bottom, 0.f, [&] { return reference_parent_height(e); });
+                        if (s.box_sizing == style::box_type::border_box)
+                        {
+                            h -= s.border.top.get();
+                            h -= s.border.bottom.get();
+                        }
+                        return h;
+                    });
+            }
         }
 
-        float compute_content_width(layouted_element& e)
+        // positions
+        // NOTE: parent and previous siblings are already placed
+    public:
+        void place_x(layouted_element& e)
         {
-            CC_ASSERT(e.content_width != computing && "cyclic layout detected");
-            if (e.content_width != unassigned)
-                return e.content_width;
-            e.content_width = computing;
+            auto const& s = style_of(e);
 
-            float w = 0.f;
-            if (e.style.bounds.width.is_auto()) // from children
+            if (e.is_absolute())
             {
-                auto const cs = e.child_start;
-                auto const ce = e.child_start + e.child_count;
+                auto is_left_auto = e.local_style.left.is_auto();
+                auto is_right_auto = s.bounds.right.is_auto();
+                auto is_width_auto = e.local_style.width.is_auto();
 
-                switch (e.style.layout)
-                {
-                case style::layout::left_right:
+                if (is_left_auto && is_right_auto && !is_width_auto)
                 {
-                    w = e.text_width;
-                    auto last_normal = -1;
-                    for (auto i = cs; i < ce; ++i)
-                    {
-                        auto& c = merger._layout_tree[i];
-                        if (c.is_normal())
-                            last_normal = i;
-                    }
-                    if (last_normal != -1)
-                    {
-                        auto& c = merger._layout_tree[last_normal];
-                        w = get_right(c) + get_right_margin(c) - compute_x(e);
-                    }
+                    CC_ASSERT(false && "TODO: centering");
                 }
-                break;
-                case style::layout::top_down:
+                else if (!is_left_auto) // left aligned
                 {
-                    w = e.text_width;
-                    for (auto i = cs; i < ce; ++i)
-                    {
-                        auto& c = merger._layout_tree[i];
-                        if (c.is_normal())
-                            w = tg::max(w, compute_width(c) + get_left_margin(c) + get_right_margin(c));
-                    }
+                    auto margin_left = get_left_margin(e);
+                    auto left = resolve(e.local_style.left, 0.f, [&] { return reference_parent_width(e); });
+                    e.x = reference_parent_x(e) + margin_left + left;
                 }
-                break;
+                else // right aligned
+                {
+                    auto margin_right = get_right_margin(e);
+                    auto right = resolve(s.bounds.right, 0.f, [&] { return reference_parent_width(e); });
+                    e.x = reference_parent_x(e) + reference_parent_width(e) - margin_right - right - value_of(e.width);
                 }
             }
-            else if (e.style.box_sizing == style::box_type::content_box) // from parent
+            else if (e.has_prev_normal_sibling() && is_parent_left_right(e)) // left-right layout with prev sibling
             {
-                w = resolve(e.style.bounds.width, 0.f, [&] { return reference_parent_width(e); });
+                auto& sibling = merger._layout_tree[e.prev_normal_idx];
+                e.x = get_right(sibling) + tg::max(get_left_margin(e), get_right_margin(sibling));
             }
-            else // from width
+            else
             {
-                w = compute_width(e);
-                w -= resolve(e.style.padding.left, 0.f, [&] { return reference_parent_width(e); });
-                w -= resolve(e.style.padding.right, 0.f, [&] { return reference_parent_width(e); });
-
-                if (e.style.box_sizing == style::box_type::border_box)
-                {
-                    w -= e.style.border.left.get();
-                    w -= e.style.border.right.get();
-                }
+                e.x = reference_parent_content_x_with_text(e) + get_left_margin(e);
             }
-            e.content_width = w;
 
-            CC_ASSERT(is_valid(e.content_width));
-            return e.content_width;
+            // stretched
+            if (is_stretched_x(e))
+            {
+                auto margin_right = get_right_margin(e);
+                auto right = resolve(s.bounds.right, 0.f, [&] { return reference_parent_width(e); });
+                auto max_x = reference_parent_x(e) + reference_parent_width(e) - margin_right - right;
+                e.width = max_x - e.x;
+            }
         }
 
-        float compute_content_height(layouted_element& e)
+        void place_y(layouted_element& e)
         {
-            CC_ASSERT(e.content_height != computing && "cyclic layout detected");
-            if (e.content_height != unassigned)
-                return e.content_height;
-            e.content_height = computing;
+            auto const& s = style_of(e);
 
-            float h = 0.f;
-            if (e.style.bounds.height.is_auto()) // from children
+            if (e.is_absolute())
             {
-                auto const cs = e.child_start;
-                auto const ce = e.child_start + e.child_count;
+                auto is_top_auto = e.local_style.top.is_auto();
+                auto is_bottom_auto = s.bounds.bottom.is_auto();
+                auto is_height_auto = e.local_style.height.is_auto();
 
-                switch (e.style.layout)
-                {
-                case style::layout::left_right:
+                if (is_top_auto && is_bottom_auto && !is_height_auto)
                 {
-                    h = e.text_height;
-                    for (auto i = cs; i < ce; ++i)
-                    {
-                        auto& c = merger._layout_tree[i];
-                        if (c.is_normal())
-                            h = tg::max(h, compute_height(c) + get_top_margin(c) + get_bottom_margin(c));
-                    }
+                    CC_ASSERT(false && "TODO: centering");
                 }
-                break;
-                case style::layout::top_down:
+                else if (!is_top_auto) // top aligned
                 {
-                    h = e.text_height;
-                    auto last_normal = -1;
-                    for (auto i = cs; i < ce; ++i)
-                    {
-                        auto& c = merger._layout_tree[i];
-                        if (c.is_normal())
-                            last_normal = i;
-                    }
-                    if (last_normal != -1)
-                    {
-                        auto& c = merger._layout_tree[last_normal];
-                        h = get_bottom(c) + get_bottom_margin(c) - compute_y(e);
-                    }
+                    auto margin_top = get_top_margin(e);
+                    auto top = resolve(e.local_style.top, 0.f, [&] { return reference_parent_height(e); });
+                    e.y = reference_parent_y(e) + margin_top + top;
                 }
-                break;
+                else // bottom aligned
+                {
+                    auto margin_bottom = get_bottom_margin(e);
+                    auto bottom = resolve(s.bounds.bottom, 0.f, [&] { return reference_parent_height(e); });
+                    e.y = reference_parent_y(e) + reference_parent_height(e) - margin_bottom - bottom - value_of(e.height);
                 }
             }
-            else if (e.style.box_sizing == style::box_type::content_box) // from parent
+            else if (e.has_prev_normal_sibling() && is_parent_top_down(e)) // top-down layout with prev sibling
             {
-                h = resolve(e.style.bounds.height, 0.f, [&] { return reference_parent_height(e); });
+                auto& sibling = merger._layout_tree[e.prev_normal_idx];
+                e.y = get_bottom(sibling) + tg::max(get_top_margin(e), get_bottom_margin(sibling));
             }
-            else // from height
+            else
             {
-                h = compute_height(e);
-                h -= resolve(e.style.padding.top, 0.f, [&] { return reference_parent_height(e); });
-                h -= resolve(e.style.padding.bottom, 0.f, [&] { return reference_parent_height(e); });
+                e.y = reference_parent_content_y_with_text(e) + get_top_margin(e);
+            }
 
-                if (e.style.box_sizing == style::box_type::border_box)
-                {
-                    h -= e.style.border.top.get();
-                    h -= e.style.border.bottom.get();
-                }
+            // stretched
+            if (is_stretched_y(e))
+            {
+                auto margin_bottom = get_bottom_margin(e);
+                auto bottom = resolve(s.bounds.bottom, 0.f, [&] { return reference_parent_height(e); });
+                auto max_y = reference_parent_y(e) + reference_parent_height(e) - margin_bottom - bottom;
+                e.height = max_y - e.y;
             }
-            e.content_height = h;
+        }
 
-            CC_ASSERT(is_valid(e.content_height));
-            return e.content_height;
+        // reuse
+    public:
+        bool is_reuse_root(layouted_element const& e, int layout_idx) const
+        {
+            if (!e.is_layout_reused)
+                return false;
+
+            // NOTE: detached elements are not part of their parent's subtree
+            return !merger.is_in_child_range(layout_idx) || !merger._layout_tree[e.parent_idx].is_layout_reused;
         }
 
-        // entry points
+        // passes
     public:
-        void compute_all(layouted_element& e)
+        void measure(layouted_element& e)
         {
-            CC_ASSERT(e.element);
+            // NOTE: sizes of reused layouts are already known
+            if (e.is_layout_reused)
+                return;
 
-            // force layout values
-            compute_x(e);
-            compute_y(e);
-            compute_width(e);
-            compute_height(e);
-            compute_content_x(e);
-            compute_content_y(e);
-            compute_content_width(e);
-            compute_content_height(e);
+            try_compute_width(e);
+            try_compute_height(e);
+        }
 
-            // set properties
-            tree.set_property(*e.element, si::property::aabb, e.bounds());
+        void place(layouted_element& e, int layout_idx)
+        {
+            if (e.is_layout_reused && !is_reuse_root(e, layout_idx))
+            {
+                // only the root of a reused subtree is positioned, the rest follows
+                auto const& p = parent_of(e);
+                auto const& prev = merger._prev_layout_slots[layout_idx];
+                e.x = p.x + prev.rel_x;
+                e.y = p.y + prev.rel_y;
+                e.content_x = e.x + prev.content_dx;
+                e.content_y = e.y + prev.content_dy;
+            }
+            else
+            {
+                // sizes that depend on the parent
+                try_compute_width(e);
+                try_compute_height(e);
+
+                is_missing = false;
+                place_x(e);
+                place_y(e);
+                CC_ASSERT(!is_missing && "cyclic layout detected");
+
+                // sizes that depend on stretched sizes
+                try_compute_width(e);
+                try_compute_height(e);
+                CC_ASSERT(e.width != unassigned && e.content_width != unassigned && "cyclic layout detected");
+                CC_ASSERT(e.height != unassigned && e.content_height != unassigned && "cyclic layout detected");
+
+                auto const& s = style_of(e);
+                e.content_x = e.x + s.border.left.get() + resolve(s.padding.left, 0.f, [&] { return reference_parent_width(e); });
+                e.content_y = e.y + s.border.top.get() + resolve(s.padding.top, 0.f, [&] { return reference_parent_height(e); });
+            }
 
-            // recurse into children
-            auto cs = e.child_start;
-            auto ce = e.child_start + e.child_count;
-            for (auto i = cs; i < ce; ++i)
-                compute_all(merger._layout_tree[i]);
+            CC_ASSERT(is_valid(e.x) && is_valid(e.y));
+            CC_ASSERT(is_valid(e.content_x) && is_valid(e.content_y));
         }
 
         void fill_pass(layouted_element& e)
         {
-            if (e.style.bounds.fill_width)
+            // reused layouts are already final
+            // NOTE: roots of reused subtrees never fill
+            if (e.is_layout_reused)
+                return;
+
+            if (style_of(e).bounds.fill_width)
             {
                 auto p_right = e.is_root() ? merger.viewport.max.x : get_content_right(parent_of(e));
-                auto e_right = e.x + e.width + e.style.margin.right.get(); // TODO: box sizing?
+                auto e_right = e.x + e.width + get_right_margin(e); // TODO: box sizing?
                 if (e_right < p_right)
                 {
                     auto dw = p_right - e_right;
@@ -591,25 +690,22 @@ void si::Default2DMerger::resolve_layout_new(si::element_tree& tree)
                 }
             }
 
-            if (e.style.bounds.fill_height)
+            if (style_of(e).bounds.fill_height)
             {
                 CC_ASSERT(false && "not implemented");
             }
-
-            // recurse into children
-            auto cs = e.child_start;
-            auto ce = e.child_start + e.child_count;
-            for (auto i = cs; i < ce; ++i)
-                fill_pass(merger._layout_tree[i]);
         }
 
         void on_after_layout(layouted_element& le)
         {
             // text align
-            if (le.has_text)
+            // NOTE: wrapped text is aligned per line when rendering
+            if (is_wrapped_text(le))
+                le.text_origin = {le.content_x, le.content_y};
+            else if (le.has_text)
             {
                 // TODO: vertical align?
-                switch (le.style.font.align)
+                switch (style_of(le).font.align)
                 {
                 case style::font_align::left:
                     le.text_origin = {le.content_x, le.content_y};
@@ -649,29 +745,218 @@ void si::Default2DMerger::resolve_layout_new(si::element_tree& tree)
 
                 // NOTE: only works for non-special types currently
                 // TODO: align?
-                merger.set_editable_text_glyphs(txt, le.x, le.y, le.style.font);
+                merger.set_editable_text_glyphs(txt, le.x, le.y, style_of(le).font, is_wrapped_text(le) ? le.content_width : -1.f);
                 le.is_in_text_edit = true;
             }
-
-            // recurse into children
-            auto cs = le.child_start;
-            auto ce = le.child_start + le.child_count;
-            for (auto i = cs; i < ce; ++i)
-                on_after_layout(merger._layout_tree[i]);
         }
     };
 
+    prepare_layout_reuse(tree);
+
     auto layouter = layouter_t(tree, *this);
+    auto const cnt = int(_layout_tree.size());
+    auto const job_cnt = int(_style_root_jobs.size());
 
-    // force computation of all layout values
-    for (auto i : _layout_roots)
-        layouter.compute_all(_layout_tree[i]);
+    if (parallel_layout && job_cnt > 1)
+    {
+        if (!_workers)
+            _workers = cc::make_unique<detail::worker_pool>();
+
+        if (int(_layout_text_updates.size()) < job_cnt)
+            _layout_text_updates.resize(job_cnt);
+
+        // measure intrinsic sizes (bottom-up, per root subtree)
+        _workers->parallel_for(job_cnt, [&](int j) {
+            auto const& job = _style_root_jobs[j];
+            auto job_layouter = layouter_t(tree, *this);
+            job_layouter.text_updates = &_layout_text_updates[j];
+            for (auto i = job.slot_end - 1; i >= job.slot_start; --i)
+                if (_layout_tree[i].element)
+                    job_layouter.measure(_layout_tree[i]);
+            job_layouter.measure(_layout_tree[job.layout_idx]);
+        });
+
+        // place roots
+        // NOTE: jobs are sorted by layout_idx
+        for (auto const& job : _style_root_jobs)
+            layouter.place(_layout_tree[job.layout_idx], job.layout_idx);
+
+        // place elements and resolve remaining sizes (top-down, per root subtree)
+        _workers->parallel_for(job_cnt, [&](int j) {
+            auto const& job = _style_root_jobs[j];
+            auto job_layouter = layouter_t(tree, *this);
+            job_layouter.text_updates = &_layout_text_updates[j];
+            for (auto i = job.slot_start; i < job.slot_end; ++i)
+                if (_layout_tree[i].element)
+                    job_layouter.place(_layout_tree[i], i);
+        });
+
+        // new text cache entries in root order
+        for (auto j = 0; j < job_cnt; ++j)
+            merge_text_cache_updates(_layout_text_updates[j]);
+    }
+    else
+    {
+        // measure intrinsic sizes (bottom-up)
+        for (auto i = cnt - 1; i >= 0; --i)
+            if (_layout_tree[i].element)
+                layouter.measure(_layout_tree[i]);
+
+        // place elements and resolve remaining sizes (top-down)
+        for (auto i = 0; i < cnt; ++i)
+            if (_layout_tree[i].element)
+                layouter.place(_layout_tree[i], i);
+    }
+
+    // set properties
+    // NOTE: before fill
+    for (auto const& le : _layout_tree)
+        if (le.element)
+            tree.set_property(*le.element, si::property::aabb, le.bounds());
 
     // post-process fill
-    for (auto i : _layout_roots)
-        layouter.fill_pass(_layout_tree[i]);
+    for (auto i = 0; i < cnt; ++i)
+        if (_layout_tree[i].element)
+            layouter.fill_pass(_layout_tree[i]);
 
     // resolve style values
-    for (auto i : _layout_roots)
-        layouter.on_after_layout(_layout_tree[i]);
+    for (auto i = 0; i < cnt; ++i)
+        if (_layout_tree[i].element)
+            layouter.on_after_layout(_layout_tree[i]);
+}
+
+void si::Default2DMerger::prepare_layout_reuse(si::element_tree const& tree)
+{
+    std::swap(_layout_slots, _prev_layout_slots);
+    _layout_slots.clear();
+    _layout_slots.resize(_layout_tree.size());
+    _stats_layouts_reused = 0;
+
+    // subtree hashes (bottom-up)
+    // NOTE: children always have a larger index than their parent
+    //       the child range is part of the hash so that the subtree occupies the same slots
+    for (auto i = int(_layout_tree.size()) - 1; i >= 0; --i)
+    {
+        auto const& le = _layout_tree[i];
+        if (!le.element)
+            continue; // hole
+
+        auto const& ls = le.local_style;
+        auto h = detail::make_hash(0x4c41594f55540000, le.style_idx, le.text_width, le.text_height, le.child_start, le.child_count);
+        hash_value(h, ls.left);
+        hash_value(h, ls.top);
+        hash_value(h, ls.width);
+        hash_value(h, ls.height);
+        detail::combine_hash(h, ls.visibility);
+        detail::combine_hash(h, ls.positioning);
+
+        // NOTE: the wrapped size depends on the text itself, not only on its single-line size
+        if (le.has_text && style_of(le).font.wrap)
+            detail::combine_hash(h, text_key(tree.get_property(*le.element, si::property::text), style_of(le).font));
+
+        for (auto ci = le.child_start; ci < le.child_start + le.child_count; ++ci)
+            detail::combine_hash(h, _layout_slots[ci].subtree_hash);
+
+        _layout_slots[i].subtree_hash = h;
+    }
+
+    // mark reused subtrees (top-down) and preload their sizes
+    // a subtree can be reused if
+    //   - its inputs are unchanged
+    //   - its size did not depend on its parent last frame (otherwise we would need the parent's size first)
+    //   - it does not fill its parent (fill_pass is not idempotent for changed parents)
+    // positions are computed for the subtree root and translated for the rest (see place_reused_children)
+    for (auto i = 0; i < int(_layout_tree.size()) && i < int(_prev_layout_slots.size()); ++i)
+    {
+        auto& le = _layout_tree[i];
+        if (!le.element)
+            continue;
+
+        auto const& prev = _prev_layout_slots[i];
+        if (prev.subtree_hash != _layout_slots[i].subtree_hash)
+            continue;
+
+        auto const is_in_reused_parent = is_in_child_range(i) && _layout_tree[le.parent_idx].is_layout_reused;
+        if (!is_in_reused_parent)
+        {
+            auto const& style = style_of(le);
+            if (prev.uses_parent_size || style.bounds.fill_width || style.bounds.fill_height)
+                continue;
+        }
+
+        le.is_layout_reused = true;
+        le.uses_parent_size = prev.uses_parent_size;
+        le.width = prev.width;
+        le.height = prev.height;
+        le.content_width = prev.content_width;
+        le.content_height = prev.content_height;
+        // NOTE: the style pass only measures single-line text, reused layouts are not re-wrapped
+        le.text_width = prev.text_width;
+        le.text_height = prev.text_height;
+        le.is_text_wrapped = le.has_text && style_of(le).font.wrap;
+        ++_stats_layouts_reused;
+    }
+}
+
+void si::Default2DMerger::store_layout_slots()
+{
+    CC_ASSERT(_layout_slots.size() == _layout_tree.size());
+
+    auto is_changed = _layout_slots.size() != _prev_layout_slots.size();
+
+    for (auto i = 0; i < int(_layout_tree.size()); ++i)
+    {
+        auto const& le = _layout_tree[i];
+        if (!le.element)
+        {
+            // NOTE: holes have a zero hash, so an element -> hole change is detected as well
+            if (!is_changed && _prev_layout_slots[i].subtree_hash != 0)
+                is_changed = true;
+            continue;
+        }
+
+        auto& s = _layout_slots[i];
+        s.bounds = le.bounds();
+        s.id = le.element->id;
+        s.no_input = le.no_input;
+
+        // NOTE: subtree_hash covers style (consumes_input), visibility and the child ranges
+        if (!is_changed)
+        {
+            auto const& prev = _prev_layout_slots[i];
+            is_changed = prev.subtree_hash != s.subtree_hash || prev.id != s.id || prev.no_input != s.no_input //
+                         || prev.bounds.min != s.bounds.min || prev.bounds.max != s.bounds.max;
+        }
+
+        s.width = le.width;
+        s.height = le.height;
+        s.content_width = le.content_width;
+        s.content_height = le.content_height;
+        s.text_width = le.text_width;
+        s.text_height = le.text_height;
+        s.uses_parent_size = le.uses_parent_size;
+
+        // NOTE: relative positions of translated elements are kept as is
+        //       (recomputing them from absolute positions would accumulate rounding errors)
+        auto const& p = le.is_root() ? le : _layout_tree[le.parent_idx];
+        auto const is_translated = le.is_layout_reused && is_in_child_range(i) && p.is_layout_reused;
+        if (is_translated)
+        {
+            auto const& prev = _prev_layout_slots[i];
+            s.rel_x = prev.rel_x;
+            s.rel_y = prev.rel_y;
+            s.content_dx = prev.content_dx;
+            s.content_dy = prev.content_dy;
+        }
+        else
+        {
+            s.rel_x = le.is_root() ? le.x : le.x - p.x;
+            s.rel_y = le.is_root() ? le.y : le.y - p.y;
+            s.content_dx = le.content_x - le.x;
+            s.content_dy = le.content_y - le.y;
+        }
+    }
+
+    if (is_changed)
+        ++_layout_generation;
 }
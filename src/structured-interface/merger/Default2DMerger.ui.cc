@@ -31,10 +31,14 @@ void si::Default2DMerger::show_stats_ui(bool use_window)
         {
             auto const& rd = get_render_data();
             si::text("lists: {}", rd.lists.size());
+            si::text("occluded elements: {}", _stats_occluded_elements);
+            si::text("reused lists: {} / {}", _stats_render_lists_reused, rd.lists.size());
             for (auto const& l : rd.lists)
             {
+                si::text("list {}: {}", l.id, l.is_changed ? "changed" : "unchanged");
                 si::text("vertices: {}", l.vertices.size());
-                si::text("indices: {}", l.indices.size());
+                si::text("indices: {}{}", l.index_count(), l.use_indices16 ? " (16 bit)" : "");
+                si::text("instances: {}", l.instances.size());
                 si::text("cmds: {}", l.cmds.size());
             }
         }
@@ -44,12 +48,26 @@ void si::Default2DMerger::show_stats_ui(bool use_window)
             si::text("nodes: {}", _layout_tree.size());
             si::text("roots: {}", _layout_roots.size());
             si::text("deferred placements: {}", _deferred_placements.size());
+            si::text("reused layouts: {} / {}", _stats_layouts_reused, _layout_tree.size());
+            si::text("parallel: {}", parallel_layout);
         }
 
         if (auto h = si::collapsible_group("style data"))
         {
             si::text("rules: {}", _stylesheet.get_style_rule_count());
             si::text("cached styles: {}", _stylesheet.get_cached_styles_count());
+            si::text("interned styles: {}", _style_table.size());
+            si::text("reused styles: {} / {}", _stats_styles_reused, _layout_tree.size());
+            si::text("parallel: {} ({} roots)", parallel_style, _style_root_jobs.size());
+        }
+
+        if (auto h = si::collapsible_group("text data"))
+        {
+            si::text("cached metrics: {}", _text_metrics.size());
+            si::text("cached glyph runs: {}", _glyph_runs.size());
+            si::text("cached wrapped texts: {}", _wrapped_texts.size());
+            if (_glyph_atlas.is_loaded())
+                si::text("glyph atlas: {} pages, {} evictions", _glyph_atlas.page_count(), _glyph_atlas.eviction_count());
         }
     };
 
@@ -88,15 +106,22 @@ void si::Default2DMerger::show_inspector_ui(si::element_tree const& ui)
                 si::text("children: {} (start at {})", e->children_count, e->children_start);
                 si::text("properties: {} (start at {})", e->properties_count, e->properties_start);
 
-                for (auto const& le : _layout_tree)
-                    if (le.element && le.element->id == curr_id)
-                    {
-                        si::text("pos: ({}, {})", le.x, le.y);
-                        si::text("size: {} x {}", le.width, le.height);
-                        si::text("content pos: ({}, {})", le.content_x, le.content_y);
-                        si::text("content size: {} x {}", le.content_width, le.content_height);
-                        si::text("text size: {} x {}", le.text_width, le.text_height);
-                    }
+                // NOTE: falls back to a linear search if ui is not the last merged tree
+                auto ple = get_layout_element_of(ui, *e);
+                if (!ple)
+                    for (auto const& le : _layout_tree)
+                        if (le.element && le.element->id == curr_id)
+                            ple = &le;
+
+                if (ple)
+                {
+                    auto const& le = *ple;
+                    si::text("pos: ({}, {})", le.x, le.y);
+                    si::text("size: {} x {}", le.width, le.height);
+                    si::text("content pos: ({}, {})", le.content_x, le.content_y);
+                    si::text("content size: {} x {}", le.content_width, le.content_height);
+                    si::text("text size: {} x {}", le.text_width, le.text_height);
+                }
             }
             else
                 si::text("[element not found]");
@@ -3,7 +3,24 @@
 #include <clean-core/assertf.hh>
 #include <clean-core/xxHash.hh>
 
+#include <structured-interface/detail/color.hh>
+
 void si::StyleSheet::load_default_light_style()
+{
+    static auto const default_rules = [] {
+        StyleSheet s;
+        s.build_default_light_style();
+        return s._rules;
+    }();
+
+    _rules = default_rules;
+    ++_version;
+
+    // clear cache
+    _style_cache.clear();
+}
+
+void si::StyleSheet::build_default_light_style()
 {
     clear();
 
@@ -247,7 +264,8 @@ void si::StyleSheet::load_default_light_style()
 void si::StyleSheet::clear()
 {
     // clear styles
-    _rules.clear();
+    _rules = nullptr;
+    ++_version;
 
     // clear cache
     _style_cache.clear();
@@ -258,8 +276,9 @@ void si::StyleSheet::add_rule(cc::string_view selector, cc::unique_function<void
     // TODO: better error handling
     CC_ASSERT(!selector.empty() && "select-all must be done via '*'");
 
-    auto& r = _rules.emplace_back();
-    r.apply = cc::move(on_apply);
+    auto& rules = modify_rules();
+    auto& r = rules.rules.emplace_back();
+    r.apply = std::make_shared<cc::unique_function<void(computed_style&)> const>(cc::move(on_apply));
 
     auto string_to_type = [](cc::string_view s) -> element_type {
         for (auto i = 0; i < 128; ++i)
@@ -289,8 +308,8 @@ void si::StyleSheet::add_rule(cc::string_view selector, cc::unique_function<void
                 else if (s.starts_with('.')) // classes
                 {
                     auto cname = s.subview(1);
-                    CC_ASSERTF(_class_id_by_name.contains_key(cname), "class name '{}' not found. (did you forget to call add_or_get_class?)", cname);
-                    key.style_class = _class_id_by_name.get(cname);
+                    CC_ASSERTF(rules.class_id_by_name.contains_key(cname), "class name '{}' not found. (did you forget to call add_or_get_class?)", cname);
+                    key.style_class = rules.class_id_by_name.get(cname);
                     mask.style_class = uint16_t(0xFFFF);
                 }
                 else if (s.starts_with('#'))
@@ -399,19 +418,36 @@ void si::StyleSheet::add_rule(cc::string_view selector, cc::unique_function<void
 uint16_t si::StyleSheet::add_or_get_class(cc::string_view name)
 {
     uint16_t id;
-    if (_class_id_by_name.get_to(name, id))
+    if (_rules && _rules->class_id_by_name.get_to(name, id))
         return id;
 
-    auto new_id = uint16_t(_class_id_by_name.size() + 100); // small error prevention (also 0 is no class)
-    _class_id_by_name[name] = new_id;
+    auto& rules = modify_rules();
+    auto new_id = uint16_t(rules.class_id_by_name.size() + 100); // small error prevention (also 0 is no class)
+    rules.class_id_by_name[name] = new_id;
     return new_id;
 }
 
+si::StyleSheet::rule_set& si::StyleSheet::modify_rules()
+{
+    // copy on write
+    // NOTE: rule functions are shared and not copied
+    if (!_rules)
+        _rules = std::make_shared<rule_set>();
+    else if (_rules.use_count() > 1)
+        _rules = std::make_shared<rule_set>(*_rules);
+
+    // NOTE: cached styles might be outdated now (and query_style must agree with compute_style)
+    ++_version;
+    _style_cache.clear();
+
+    return *_rules;
+}
+
 si::StyleSheet::computed_style si::StyleSheet::query_style(si::StyleSheet::style_key key,
                                                            si::StyleSheet::style_hash parent_hash,
                                                            cc::span<const si::StyleSheet::style_key> parent_keys)
 {
-    auto const hash = cc::hash_xxh3(cc::as_byte_span(key), parent_hash);
+    auto const hash = hash_of(key, parent_hash);
 
     // get or compute style
     computed_style style;
@@ -425,11 +461,22 @@ si::StyleSheet::computed_style si::StyleSheet::query_style(si::StyleSheet::style
     return style;
 }
 
+si::StyleSheet::style_hash si::StyleSheet::hash_of(si::StyleSheet::style_key key, si::StyleSheet::style_hash parent_hash)
+{
+    return cc::hash_xxh3(cc::as_byte_span(key), parent_hash);
+}
+
 si::StyleSheet::computed_style si::StyleSheet::compute_style(si::StyleSheet::style_key key, cc::span<const si::StyleSheet::style_key> parent_keys) const
 {
     computed_style style;
 
-    for (auto const& r : _rules)
+    if (!_rules)
+    {
+        style.update_packed_colors();
+        return style;
+    }
+
+    for (auto const& r : _rules->rules)
     {
         CC_ASSERT(!r.parts.empty());
 
@@ -469,9 +516,23 @@ si::StyleSheet::computed_style si::StyleSheet::compute_style(si::StyleSheet::sty
             }
 
             if (is_matching)
-                r.apply(style);
+                (*r.apply)(style);
         }
     }
 
+    style.update_packed_colors();
     return style;
 }
+
+void si::StyleSheet::computed_style::update_packed_colors()
+{
+    packed.bg = detail::to_rgba8(bg.color);
+    packed.border = detail::to_rgba8(border.color);
+    packed.font = detail::to_rgba8(font.color);
+
+    // selection is black or white, depending on the font color
+    auto const fc = font.color;
+    auto const is_bright = (fc.r + fc.g + fc.b) / 3 > 0.5f;
+    packed.selection = detail::to_rgba8(tg::color4(is_bright ? tg::color3::white : tg::color3::black));
+    packed.font_selected = detail::to_rgba8(tg::color4(is_bright ? tg::color3::black : tg::color3::white));
+}
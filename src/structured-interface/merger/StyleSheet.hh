@@ -1,5 +1,7 @@
 #pragma once
 
+#include <memory> // shared_ptr
+
 #include <clean-core/bit_cast.hh>
 #include <clean-core/map.hh>
 #include <clean-core/span.hh>
@@ -62,6 +64,21 @@ public:
         style::font font;
         style::bounds bounds;
         bool consumes_input = true; // if true, can consume input
+
+        /// colors packed as in Default2DMerger::vertex (computed once per style, see update_packed_colors)
+        struct packed_colors
+        {
+            uint32_t bg = 0;
+            uint32_t border = 0;
+            uint32_t font = 0;
+            uint32_t selection = 0;     ///< background of selected text
+            uint32_t font_selected = 0; ///< selected text
+        };
+        packed_colors packed;
+
+        /// must be called after changing bg, border, or font colors
+        /// NOTE: compute_style already does this
+        void update_packed_colors();
         // TODO: more
         // TODO: arbitrary properties?
         // TODO: custom triangles
@@ -70,6 +87,7 @@ public:
     // Style API
 public:
     /// clears this style and sets up the default light mode style
+    /// NOTE: the default rules are compiled once per process and shared by all style sheets
     void load_default_light_style();
 
     /// clears the style sheet
@@ -88,6 +106,10 @@ public:
     /// NOTE: parents are ordered root-to-child
     computed_style query_style(style_key key, style_hash parent_hash, cc::span<style_key const> parent_keys);
 
+    /// returns the hash used to identify the style of key (given the hash of its parent style)
+    /// NOTE: this is the hash stored in computed_style::hash
+    static style_hash hash_of(style_key key, style_hash parent_hash);
+
     /// computes the style of a given element
     /// NOTE: this does NOT use the cache!
     ///       usually query_style is the better choice!
@@ -97,7 +119,9 @@ public:
     // uncommon API
 public:
     size_t get_cached_styles_count() const { return _style_cache.size(); }
-    size_t get_style_rule_count() const { return _rules.size(); }
+    size_t get_style_rule_count() const { return _rules ? _rules->rules.size() : 0; }
+    /// is incremented whenever rules change (i.e. previously queried styles might be outdated)
+    int get_version() const { return _version; }
 
     // style member
 private:
@@ -115,14 +139,28 @@ private:
         };
 
         cc::vector<part> parts;
-        cc::unique_function<void(computed_style&)> apply; // changes the style
+        std::shared_ptr<cc::unique_function<void(computed_style&)> const> apply; // changes the style
 
         // TODO: priority?
     };
 
-    cc::vector<style_rule> _rules;
+    /// compiled rules, shared between style sheets (e.g. the default style)
+    /// NOTE: never modified while shared, modifications copy it first
+    struct rule_set
+    {
+        cc::vector<style_rule> rules;
+        cc::map<cc::string, uint16_t> class_id_by_name;
+    };
+
+    /// returns an unshared rule set
+    /// NOTE: increments the version and clears the style cache
+    rule_set& modify_rules();
+
+    void build_default_light_style();
+
+    std::shared_ptr<rule_set> _rules; // nullptr if empty
 
-    cc::map<cc::string, uint16_t> _class_id_by_name;
+    int _version = 0;
 
     // cache member
 private:
@@ -1,5 +1,30 @@
 #include "editable_text.hh"
 
+#include <structured-interface/detail/utf8.hh>
+
+namespace
+{
+// NOTE: cursor and selection are byte indices that never point into multi-byte chars
+
+size_t prev_char_start(cc::string_view txt, size_t pos)
+{
+    CC_ASSERT(pos > 0);
+    --pos;
+    while (pos > 0 && si::detail::is_utf8_continuation(txt[pos]))
+        --pos;
+    return pos;
+}
+
+size_t next_char_start(cc::string_view txt, size_t pos)
+{
+    CC_ASSERT(pos < txt.size());
+    ++pos;
+    while (pos < txt.size() && si::detail::is_utf8_continuation(txt[pos]))
+        ++pos;
+    return pos;
+}
+}
+
 void si::merger::editable_text::on_text_input(cc::string_view s)
 {
     if (has_selection()) // replace selection
@@ -39,8 +64,9 @@ void si::merger::editable_text::remove_prev_char()
     if (_cursor == 0)
         return;
 
-    _text = _text.substring(0, _cursor - 1) + _text.subview(_cursor);
-    _cursor--;
+    auto start = prev_char_start(_text, _cursor);
+    _text = _text.substring(0, start) + _text.subview(_cursor);
+    _cursor = start;
 }
 
 void si::merger::editable_text::remove_next_char()
@@ -56,7 +82,7 @@ void si::merger::editable_text::remove_next_char()
     if (_cursor == _text.size())
         return;
 
-    _text = _text.substring(0, _cursor) + _text.subview(_cursor + 1);
+    _text = _text.substring(0, _cursor) + _text.subview(next_char_start(_text, _cursor));
 }
 
 void si::merger::editable_text::select_all()
@@ -76,14 +102,14 @@ void si::merger::editable_text::move_cursor_left()
 {
     deselect();
     if (_cursor > 0)
-        --_cursor;
+        _cursor = prev_char_start(_text, _cursor);
 }
 
 void si::merger::editable_text::move_cursor_right()
 {
     deselect();
     if (_cursor < _text.size())
-        ++_cursor;
+        _cursor = next_char_start(_text, _cursor);
 }
 
 void si::merger::editable_text::reset(cc::string new_text)
@@ -0,0 +1,314 @@
+#include "glyph_atlas.hh"
+
+#include <cstring> // memcpy
+
+#include <clean-core/assert.hh>
+
+#include <structured-interface/extern/stb_truetype.hh>
+
+namespace
+{
+// NOTE: glyphs are rasterized per whole px size
+int px_size_of(float size) { return tg::max(1, int(size + 0.5f)); }
+}
+
+si::merger::glyph_atlas::glyph_atlas() = default;
+si::merger::glyph_atlas::~glyph_atlas() = default;
+
+bool si::merger::glyph_atlas::load_ttf(cc::vector<std::byte> ttf)
+{
+    auto data = reinterpret_cast<unsigned char const*>(ttf.data());
+
+    auto offset = si_stbtt_GetFontOffsetForIndex(data, 0);
+    if (offset < 0)
+        return false;
+
+    auto info = cc::make_unique<si_stbtt_fontinfo>();
+    if (!si_stbtt_InitFont(info.get(), data, offset))
+        return false;
+
+    // NOTE: info points into the ttf data (moving keeps the allocation)
+    _ttf = cc::move(ttf);
+    _info = cc::move(info);
+
+    // NOTE: metrics are cached so that no lookup needs to query the font
+    _em_scale = si_stbtt_ScaleForMappingEmToPixels(_info.get(), 1.f);
+    si_stbtt_GetFontVMetrics(_info.get(), &_ascent, &_descent, &_line_gap);
+
+    for (auto c = 0; c < 128; ++c)
+    {
+        int lsb;
+        _ascii_glyph_index[c] = si_stbtt_FindGlyphIndex(_info.get(), c);
+        si_stbtt_GetGlyphHMetrics(_info.get(), _ascii_glyph_index[c], &_ascii_advance[c], &lsb);
+    }
+
+    build_kerning();
+
+    _pages.clear();
+    _glyphs.clear();
+    _glyph_keys.clear();
+    _glyph_idx.clear();
+    _codepoint_metrics.clear();
+    _dirty_rects.clear();
+    ++_eviction_count;
+    return true;
+}
+
+float si::merger::glyph_atlas::raster_size_of(float size) const
+{
+    // NOTE: distance fields are rasterized once and scaled
+    return sdf ? float(sdf_size) : float(px_size_of(size));
+}
+
+float si::merger::glyph_atlas::scale_for(float size) const
+{
+    CC_ASSERT(is_loaded());
+    // NOTE: sdf glyphs are scaled freely so metrics use the exact size
+    return _em_scale * (sdf ? size : float(px_size_of(size)));
+}
+
+float si::merger::glyph_atlas::glyph_scale(float size) const { return sdf ? size / sdf_size : 1.f; }
+
+float si::merger::glyph_atlas::ascender(float size) const { return _ascent * scale_for(size); }
+
+float si::merger::glyph_atlas::line_height(float size) const { return (_ascent - _descent + _line_gap) * scale_for(size); }
+
+si::merger::glyph_atlas::codepoint_metrics si::merger::glyph_atlas::metrics_of(char32_t codepoint) const
+{
+    if (codepoint < 128)
+        return {codepoint, _ascii_glyph_index[codepoint], _ascii_advance[codepoint]};
+
+    codepoint_metrics m;
+    if (_codepoint_metrics.get_to(uint32_t(codepoint), m))
+        return m;
+
+    // not rendered yet
+    int lsb;
+    m.codepoint = codepoint;
+    m.glyph_index = si_stbtt_FindGlyphIndex(_info.get(), int(codepoint)); // 0 is the "missing" glyph
+    si_stbtt_GetGlyphHMetrics(_info.get(), m.glyph_index, &m.advance, &lsb);
+    return m;
+}
+
+float si::merger::glyph_atlas::advance(codepoint_metrics const& m, float size) const { return m.advance * scale_for(size); }
+
+void si::merger::glyph_atlas::build_kerning()
+{
+    _has_kerning = false;
+    _ascii_kerning = cc::vector<int16_t>::defaulted(kern_count * kern_count);
+    _kern_pairs.clear();
+
+    // NOTE: also includes GPOS pair adjustments
+    for (auto a = 0; a < kern_count; ++a)
+        for (auto b = 0; b < kern_count; ++b)
+        {
+            auto k = si_stbtt_GetGlyphKernAdvance(_info.get(), _ascii_glyph_index[kern_first + a], _ascii_glyph_index[kern_first + b]);
+            _ascii_kerning[a * kern_count + b] = int16_t(k);
+            _has_kerning |= k != 0;
+        }
+
+    // NOTE: only the 'kern' table can be enumerated
+    auto cnt = si_stbtt_GetKerningTableLength(_info.get());
+    if (cnt > 0)
+    {
+        cc::vector<si_stbtt_kerningentry> entries;
+        entries.resize(cnt);
+        cnt = si_stbtt_GetKerningTable(_info.get(), entries.data(), cnt);
+        for (auto i = 0; i < cnt; ++i)
+            if (entries[i].advance != 0)
+                _kern_pairs[kern_key(entries[i].glyph1, entries[i].glyph2)] = entries[i].advance;
+        _has_kerning |= !_kern_pairs.empty();
+    }
+}
+
+float si::merger::glyph_atlas::kerning(codepoint_metrics const& prev, codepoint_metrics const& m, float size) const
+{
+    if (!_has_kerning)
+        return 0;
+
+    auto const a = int(prev.codepoint) - kern_first;
+    auto const b = int(m.codepoint) - kern_first;
+    if (unsigned(a) < unsigned(kern_count) && unsigned(b) < unsigned(kern_count))
+        return _ascii_kerning[a * kern_count + b] * scale_for(size);
+
+    if (_kern_pairs.empty())
+        return 0;
+
+    return _kern_pairs.get_or(kern_key(prev.glyph_index, m.glyph_index), 0) * scale_for(size);
+}
+
+si::merger::glyph_atlas::glyph const* si::merger::glyph_atlas::get_glyph(char32_t codepoint, float size)
+{
+    auto const raster_size = raster_size_of(size);
+    auto const key = glyph_key(codepoint, int(raster_size));
+
+    int idx;
+    if (_glyph_idx.get_to(key, idx))
+    {
+        auto const& g = _glyphs[idx];
+        if (g.page >= 0)
+            touch_page(g.page);
+        return &g;
+    }
+
+    auto const scale = scale_for(raster_size);
+    auto const m = metrics_of(codepoint);
+    auto const gi = m.glyph_index;
+    if (codepoint >= 128)
+        _codepoint_metrics[uint32_t(codepoint)] = m;
+
+    // NOTE: distance fields are computed up front because they are larger than the glyph box
+    unsigned char* sdf_bitmap = nullptr;
+    int x0 = 0, y0 = 0, w = 0, h = 0;
+    if (sdf)
+        sdf_bitmap = si_stbtt_GetGlyphSDF(_info.get(), scale, gi, sdf_padding, (unsigned char)sdf_on_edge, sdf_pixel_dist_scale, &w, &h, &x0, &y0);
+    else
+    {
+        int x1, y1;
+        si_stbtt_GetGlyphBitmapBox(_info.get(), gi, scale, scale, &x0, &y0, &x1, &y1);
+        w = x1 - x0;
+        h = y1 - y0;
+    }
+
+    glyph g;
+    g.bearingX = float(x0);
+    g.bearingY = float(-y0);
+    g.width = float(w);
+    g.height = float(h);
+    g.advance = m.advance * scale;
+
+    // NOTE: invisible glyphs have no page
+    //       neither have oversized ones (the page-less entry prevents rasterizing them again)
+    if (w > 0 && h > 0 && fits_empty_page(w, h))
+    {
+        int page, x, y;
+        if (!alloc(w, h, page, x, y))
+        {
+            si_stbtt_FreeSDF(sdf_bitmap, nullptr);
+            return nullptr;
+        }
+
+        auto& p = _pages[page];
+        auto pixels = reinterpret_cast<unsigned char*>(p.data.data()) + y * page_size + x;
+        if (sdf)
+        {
+            for (auto r = 0; r < h; ++r)
+                std::memcpy(pixels + r * page_size, sdf_bitmap + r * w, w);
+        }
+        else
+            si_stbtt_MakeGlyphBitmap(_info.get(), pixels, w, h, page_size, scale, scale, gi);
+
+        auto const s = 1.f / page_size;
+        g.page = page;
+        g.uv = {{x * s, y * s}, {(x + w) * s, (y + h) * s}};
+        _dirty_rects.push_back({page, x, y, w, h});
+    }
+    si_stbtt_FreeSDF(sdf_bitmap, nullptr);
+
+    // NOTE: after alloc because eviction compacts _glyphs
+    idx = int(_glyphs.size());
+    _glyphs.push_back(g);
+    _glyph_keys.push_back(key);
+    _glyph_idx[key] = idx;
+    return &_glyphs.back();
+}
+
+void si::merger::glyph_atlas::touch_page(int page) { _pages[page].last_used_frame = _frame; }
+
+void si::merger::glyph_atlas::reset_page(int page)
+{
+    auto& p = _pages[page];
+    p.data = cc::vector<std::byte>::defaulted(page_size * page_size);
+    p.shelves.clear();
+
+    // white block for untextured quads
+    p.data[0] = std::byte(255);
+    p.data[1] = std::byte(255);
+    p.data[page_size] = std::byte(255);
+    p.data[page_size + 1] = std::byte(255);
+    p.shelves.push_back({0, 2, 2 + padding});
+    p.next_y = 2 + padding;
+
+    p.last_used_frame = _frame;
+    _dirty_rects.push_back({page, 0, 0, page_size, page_size});
+}
+
+bool si::merger::glyph_atlas::alloc_in_page(int page, int w, int h, int& x, int& y)
+{
+    auto& p = _pages[page];
+
+    // best fitting shelf
+    shelf* best = nullptr;
+    for (auto& s : p.shelves)
+        if (h <= s.height && s.x + w <= page_size && (!best || s.height < best->height))
+            best = &s;
+
+    if (!best)
+    {
+        // NOTE: shelf heights are rounded so similar glyphs share shelves
+        auto sh = tg::min((h + 3) / 4 * 4, page_size - p.next_y);
+        if (h > sh || w > page_size)
+            return false;
+
+        best = &p.shelves.push_back({p.next_y, sh, 0});
+        p.next_y += sh + padding;
+    }
+
+    x = best->x;
+    y = best->y;
+    best->x += w + padding;
+    return true;
+}
+
+bool si::merger::glyph_atlas::alloc(int w, int h, int& page, int& x, int& y)
+{
+    // NOTE: evicting would not help
+    if (!fits_empty_page(w, h))
+        return false;
+
+    for (page = 0; page < int(_pages.size()); ++page)
+        if (alloc_in_page(page, w, h, x, y))
+        {
+            touch_page(page);
+            return true;
+        }
+
+    // new page
+    if (int(_pages.size()) < max_pages)
+    {
+        page = int(_pages.size());
+        _pages.emplace_back();
+        reset_page(page);
+        return alloc_in_page(page, w, h, x, y);
+    }
+
+    // evict least recently used page
+    page = -1;
+    for (auto i = 0; i < int(_pages.size()); ++i)
+        if (_pages[i].last_used_frame < _frame && (page < 0 || _pages[i].last_used_frame < _pages[page].last_used_frame))
+            page = i;
+
+    if (page < 0)
+        return false; // all pages are in use
+
+    reset_page(page);
+    ++_eviction_count;
+
+    // forget glyphs of the evicted page
+    auto cnt = 0;
+    for (auto i = 0; i < int(_glyphs.size()); ++i)
+        if (_glyphs[i].page != page)
+        {
+            _glyphs[cnt] = _glyphs[i];
+            _glyph_keys[cnt] = _glyph_keys[i];
+            ++cnt;
+        }
+    _glyphs.resize(cnt);
+    _glyph_keys.resize(cnt);
+
+    _glyph_idx.clear();
+    for (auto i = 0; i < cnt; ++i)
+        _glyph_idx[_glyph_keys[i]] = i;
+
+    return alloc_in_page(page, w, h, x, y);
+}
@@ -0,0 +1,214 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include <clean-core/array.hh>
+#include <clean-core/map.hh>
+#include <clean-core/span.hh>
+#include <clean-core/unique_ptr.hh>
+#include <clean-core/vector.hh>
+
+#include <typed-geometry/tg-lean.hh>
+
+struct si_stbtt_fontinfo;
+
+namespace si::merger
+{
+/**
+ * A glyph atlas that rasterizes glyphs of a TrueType font on demand
+ *
+ * Glyphs are rasterized per (codepoint, pixel size) into fixed-size pages.
+ * Memory is bounded by max_pages:
+ * if no page has space left, the least recently used page is cleared and reused.
+ * Pages that were used in the current frame are never evicted.
+ *
+ * Every page reserves a white 2x2 block at (0,0) so that untextured quads can be drawn with any page bound.
+ *
+ * In sdf mode, glyphs are stored once as signed distance fields (rasterized at sdf_size) and serve all font sizes.
+ * Pages then contain distances: values above sdf_on_edge are inside the glyph,
+ * and the value changes by sdf_pixel_dist_scale per px at sdf_size.
+ * Glyph metrics are at sdf_size and must be scaled by glyph_scale(size).
+ *
+ * Usage:
+ *
+ *   glyph_atlas atlas;
+ *   atlas.load_ttf(ttf_file_content);
+ *
+ *   // once per frame
+ *   atlas.next_frame();
+ *
+ *   if (auto g = atlas.get_glyph(U'ä', 20.f))
+ *       ... // g->page and g->uv
+ *
+ *   // renderer
+ *   for (auto const& r : atlas.dirty_rects())
+ *       ... // upload r from atlas.page_data(r.page)
+ *   atlas.clear_dirty_rects();
+ *
+ * Notes:
+ *
+ *   - glyph pointers are only valid until the next get_glyph
+ *   - advance, kerning, and the vertical metrics do not rasterize and are safe to call concurrently
+ *   - eviction_count changes whenever previously returned uvs became invalid
+ *   - glyphs that are larger than a page are never rasterized (they have no page, like invisible glyphs)
+ */
+struct glyph_atlas
+{
+    struct glyph
+    {
+        int page = -1;
+        tg::aabb2 uv; // in page (0..1)
+        // NOTE: in px coordinates of the rasterized size (multiply by glyph_scale for the requested size)
+        float bearingX = 0;
+        float bearingY = 0;
+        float width = 0;
+        float height = 0;
+        float advance = 0;
+    };
+
+    /// region of a page that changed since the last clear_dirty_rects
+    struct dirty_rect
+    {
+        int page = 0;
+        int x = 0;
+        int y = 0;
+        int width = 0;
+        int height = 0;
+    };
+
+    // settings
+public:
+    int page_size = 512; ///< width and height of a page in px (must be set before loading)
+    int max_pages = 8;
+    int padding = 1; ///< px between glyphs
+
+    bool sdf = false;                   ///< (must be set before loading)
+    int sdf_size = 32;                  ///< px size at which distance fields are computed
+    int sdf_padding = 4;                ///< px of distance field around each glyph
+    int sdf_on_edge = 128;              ///< value at the glyph outline
+    float sdf_pixel_dist_scale = 32.f;  ///< value change per px
+
+    // font API
+public:
+    glyph_atlas();
+    ~glyph_atlas();
+
+    /// takes the content of a .ttf file, returns false if it cannot be parsed (the previous font is kept then)
+    /// NOTE: clears all pages on success
+    bool load_ttf(cc::vector<std::byte> ttf);
+
+    bool is_loaded() const { return _info != nullptr; }
+
+    /// glyph index and advance (in font units) of a codepoint
+    /// NOTE: ASCII is a table lookup, other codepoints are cached by get_glyph (advance and kerning must stay const)
+    struct codepoint_metrics
+    {
+        char32_t codepoint = 0;
+        int glyph_index = 0;
+        int advance = 0;
+    };
+    codepoint_metrics metrics_of(char32_t codepoint) const;
+
+    /// NOTE: all metrics are in px for the given font size
+    float ascender(float size) const;
+    float line_height(float size) const;
+    float advance(char32_t codepoint, float size) const { return advance(metrics_of(codepoint), size); }
+    float advance(codepoint_metrics const& m, float size) const;
+
+    /// pair adjustment that is added to the advance of prev
+    /// NOTE: a table lookup, pairs are extracted when loading
+    ///       text loops should keep the metrics of prev instead of resolving it again
+    float kerning(char32_t prev, char32_t codepoint, float size) const { return kerning(metrics_of(prev), metrics_of(codepoint), size); }
+    float kerning(codepoint_metrics const& prev, codepoint_metrics const& m, float size) const;
+    bool has_kerning() const { return _has_kerning; }
+
+    // glyph API
+public:
+    /// factor from glyph metrics to px of the given font size
+    float glyph_scale(float size) const;
+
+    /// returns the glyph and rasterizes it if needed
+    /// returns nullptr if all pages are in use this frame
+    glyph const* get_glyph(char32_t codepoint, float size);
+
+    /// marks the page as used in the current frame (for cached quads)
+    void touch_page(int page);
+
+    /// advances the LRU frame counter
+    void next_frame() { ++_frame; }
+
+    int eviction_count() const { return _eviction_count; }
+
+    // page API
+public:
+    int page_count() const { return int(_pages.size()); }
+
+    /// single-channel coverage, page_size * page_size bytes
+    cc::span<std::byte const> page_data(int page) const { return _pages[page].data; }
+
+    /// uv of the center of the white block
+    tg::pos2 full_uv() const { return {1.f / page_size, 1.f / page_size}; }
+
+    cc::span<dirty_rect const> dirty_rects() const { return _dirty_rects; }
+    void clear_dirty_rects() { _dirty_rects.clear(); }
+
+private:
+    struct shelf
+    {
+        int y = 0;
+        int height = 0;
+        int x = 0; ///< next free x
+    };
+
+    struct page
+    {
+        cc::vector<std::byte> data;
+        cc::vector<shelf> shelves;
+        int next_y = 0; ///< start of the next shelf
+        int last_used_frame = -1;
+    };
+
+    float scale_for(float size) const;
+    void build_kerning();
+    static uint64_t kern_key(int glyph_a, int glyph_b) { return (uint64_t(uint32_t(glyph_a)) << 32) | uint32_t(glyph_b); }
+    float raster_size_of(float size) const;
+    static uint64_t glyph_key(char32_t codepoint, int px_size) { return (uint64_t(px_size) << 32) | codepoint; }
+
+    void reset_page(int page);
+    /// false if not even an empty page can hold a w x h glyph (see reset_page)
+    bool fits_empty_page(int w, int h) const { return w <= page_size && h <= page_size - 2 - padding; }
+    bool alloc_in_page(int page, int w, int h, int& x, int& y);
+    bool alloc(int w, int h, int& page, int& x, int& y);
+
+    cc::vector<std::byte> _ttf;
+    cc::unique_ptr<si_stbtt_fontinfo> _info;
+
+    // cached font metrics (in font units)
+    float _em_scale = 0; ///< 1 / units per em
+    int _ascent = 0;
+    int _descent = 0;
+    int _line_gap = 0;
+
+    // ASCII lookup tables (avoids cmap lookups for the common case)
+    cc::array<int, 128> _ascii_glyph_index; ///< codepoint -> glyph index in the font
+    cc::array<int, 128> _ascii_advance;     ///< in font units
+    cc::map<uint32_t, codepoint_metrics> _codepoint_metrics; ///< non-ASCII codepoints that went through get_glyph
+
+    // kerning (in font units)
+    static constexpr int kern_first = ' ';
+    static constexpr int kern_count = 128 - kern_first;
+    bool _has_kerning = false;
+    cc::vector<int16_t> _ascii_kerning;  ///< dense kern_count x kern_count matrix of printable ASCII pairs
+    cc::map<uint64_t, int> _kern_pairs; ///< (glyph index, glyph index) -> adjustment, for all other pairs
+
+    cc::vector<page> _pages;
+    cc::vector<glyph> _glyphs;
+    cc::vector<uint64_t> _glyph_keys; ///< parallel to _glyphs
+    cc::map<uint64_t, int> _glyph_idx; ///< glyph_key -> index in _glyphs
+    cc::vector<dirty_rect> _dirty_rects;
+
+    int _frame = 0;
+    int _eviction_count = 0;
+};
+}
@@ -179,6 +179,7 @@ struct font
     font_align align = font_align::left;
     value size = 20.f;
     tg::color4 color = tg::color4::black;
+    bool wrap = false; ///< breaks text into lines at the content width (at spaces and '\n')
     // TODO: font family, modifiers
 };
 